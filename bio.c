@@ -7,6 +7,7 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+//   For a block about to be overwritten, bnew skips the read.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
@@ -75,9 +76,9 @@ bget(uint dev, uint blockno)
     }
   }
 
-  // Not cached; recycle some unused buffer and clean buffer
-  // "clean" because B_DIRTY and not locked means log.c
-  // hasn't yet committed the changes to the buffer.
+  // Not cached; recycle some unused buffer and clean buffer.
+  // log.c pins the blocks of a transaction by holding a
+  // reference until they are installed on disk.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
       b->dev = dev;
@@ -105,6 +106,20 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for a block whose old contents don't
+// matter, such as one just allocated: zero-filled, without
+// reading the disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -139,6 +154,25 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+// Hold an extra reference to b so that it stays cached
+// even while nobody has it locked.  Used by log.c.
+void
+bpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt++;
+  release(&bcache.lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  if(b->refcnt < 1)
+    panic("bunpin");
+  b->refcnt--;
+  release(&bcache.lock);
+}
 //PAGEBREAK!
 // Blank page.
 
@@ -3,6 +3,7 @@ struct buf {
   uint dev;
   uint blockno;
   struct sleeplock lock;
+  struct waitq iowait;  // processes waiting for the disk
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
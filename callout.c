@@ -0,0 +1,165 @@
+//
+// Callouts: functions run by the clock interrupt at a given
+// tick, kept on a timing wheel.  A callout sits in the slot
+// for its deadline modulo NWHEEL, so adding or removing one
+// takes constant time, and each tick looks only at its own
+// slot, skipping callouts a whole turn or more away.
+// Sleeping processes use callouts to be woken exactly when
+// their time is up, instead of checking on every tick.
+//
+// tickslock protects the wheel; callout functions run
+// with it held.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "callout.h"
+
+#define NWHEEL 64
+
+static struct callout *wheel[NWHEEL];
+
+// Cycles of the time-stamp counter per tick, as measured
+// by the clock interrupt; 0 until two ticks have gone by.
+static uint tsctick;
+static uint lasttsc;
+
+// Arrange to call func(c) at tick expires, or at the next
+// tick if that has gone by.  Caller holds tickslock.
+void
+calloutadd(struct callout *c, uint expires, void (*func)(struct callout*), void *arg)
+{
+  struct callout **pp;
+
+  if(c->pending)
+    panic("calloutadd");
+  if((int)(expires - ticks) <= 0)
+    expires = ticks + 1;
+  c->expires = expires;
+  c->func = func;
+  c->arg = arg;
+  c->pending = 1;
+  pp = &wheel[expires % NWHEEL];
+  c->next = *pp;
+  if(c->next)
+    c->next->pprev = &c->next;
+  c->pprev = pp;
+  *pp = c;
+}
+
+// Cancel c if it hasn't run.  Caller holds tickslock.
+void
+calloutdel(struct callout *c)
+{
+  if(!c->pending)
+    return;
+  *c->pprev = c->next;
+  if(c->next)
+    c->next->pprev = c->pprev;
+  c->pending = 0;
+}
+
+// Run the callouts due at this tick.  Called by the clock
+// interrupt, on one CPU, with tickslock held.
+void
+callouttick(void)
+{
+  struct callout *c, *next;
+  uint now;
+
+  now = rdtsc();
+  if(lasttsc)
+    tsctick = now - lasttsc;
+  lasttsc = now;
+  vdsotick(now, tsctick);
+
+  for(c = wheel[ticks % NWHEEL]; c; c = next){
+    next = c->next;
+    if(c->expires != ticks)
+      continue;
+    calloutdel(c);
+    c->func(c);
+  }
+}
+
+static void
+calloutwake(struct callout *c)
+{
+  wqwakeup(c->arg);
+}
+
+// Sleep for n ticks.  Returns -1 if the process is killed first.
+int
+sleepticks(int n)
+{
+  struct callout c;
+  struct waitq wq;
+
+  c.pending = 0;
+  wq.head = 0;
+  acquire(&tickslock);
+  if(n > 0)
+    calloutadd(&c, ticks + n, calloutwake, &wq);
+  while(c.pending && !proc->killed)
+    wqsleep(&wq, &tickslock);
+  calloutdel(&c);
+  release(&tickslock);
+  return proc->killed ? -1 : 0;
+}
+
+// Sleep for sec seconds and nsec nanoseconds.  Whole ticks
+// are slept on the wheel, but the first of them is already
+// partly over, so that part and what is left of nsec are
+// then timed with the cycle counter, yielding the CPU
+// meanwhile, to a resolution of 10us.
+int
+nanosleep(int sec, int nsec)
+{
+  uint t0, cyc, rem;
+  int n;
+
+  if(sec < 0 || nsec < 0 || nsec >= 1000000000)
+    return -1;
+  n = sec*HZ + nsec/NSTICK;
+  acquire(&tickslock);
+  if(tsctick == 0){
+    // Not measured yet: round up to whole ticks.
+    release(&tickslock);
+    if(n == 0 && nsec == 0)
+      return 0;
+    return sleepticks(n + 1 + (nsec % NSTICK != 0));
+  }
+  t0 = rdtsc();
+  cyc = t0 - lasttsc;  // into the current tick
+  if(cyc > tsctick)
+    cyc = tsctick;
+  rem = tsctick / (NSTICK/10000) * (nsec % NSTICK / 10000);
+  release(&tickslock);
+
+  if(n == 0)
+    cyc = rem;  // no tick boundary to count from
+  else {
+    // sleepticks(n) wakes at a tick boundary, cyc short of
+    // n whole ticks from now.
+    cyc += rem;
+    if(cyc >= tsctick){
+      n++;
+      cyc -= tsctick;
+    }
+    if(sleepticks(n) < 0)
+      return -1;
+    t0 = rdtsc();
+  }
+  while(rdtsc() - t0 < cyc){
+    if(proc->killed)
+      return -1;
+    yield();
+  }
+  return 0;
+}
@@ -0,0 +1,10 @@
+// A function to call from the clock interrupt once ticks
+// reaches a deadline.
+struct callout {
+  uint expires;              // tick to run at
+  void (*func)(struct callout*);
+  void *arg;                 // for func
+  int pending;               // on the wheel, not yet run
+  struct callout *next;      // wheel slot list
+  struct callout **pprev;
+};
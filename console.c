@@ -10,6 +10,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -183,6 +184,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct pollq pq;  // poll() and epoll waiters
 } input;
 
 #define C(x)  ((x)-'@')  // Control-x
@@ -190,7 +192,7 @@ struct {
 void
 consoleintr(int (*getc)(void))
 {
-  int c, doprocdump = 0;
+  int c, doprocdump = 0, dolockdump = 0;
 
   acquire(&cons.lock);
   while((c = getc()) >= 0){
@@ -199,6 +201,9 @@ consoleintr(int (*getc)(void))
       // procdump() locks cons.lock indirectly; invoke later
       doprocdump = 1;
       break;
+    case C('L'):  // Lock statistics.
+      dolockdump = 1;
+      break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
             input.buf[(input.e-1) % INPUT_BUF] != '\n'){
@@ -220,6 +225,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwake(&input.pq, POLLIN);
         }
       }
       break;
@@ -229,6 +235,8 @@ consoleintr(int (*getc)(void))
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
   }
+  if(dolockdump)
+    lockdump();
 }
 
 int
@@ -269,6 +277,22 @@ consoleread(struct inode *ip, char *dst, int n)
   return target - n;
 }
 
+// Input is ready once a line is; output never waits.
+int
+consolepoll(struct inode *ip, struct pollent *e)
+{
+  int r;
+
+  acquire(&cons.lock);
+  r = POLLOUT;
+  if(input.r != input.w)
+    r |= POLLIN;
+  if(e)
+    pollrecord(&input.pq, e);
+  release(&cons.lock);
+  return r;
+}
+
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
@@ -291,6 +315,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   picenable(IRQ_KBD);
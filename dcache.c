@@ -0,0 +1,203 @@
+// Directory entry cache.
+//
+// The dentry cache remembers the results of directory lookups:
+// for a (device, directory inode, name) it holds the inode
+// number the name refers to, or 0 if the directory has no
+// such entry.  namex() consults it before locking a directory,
+// so that repeated path lookups need neither the directory's
+// sleeplock nor its blocks.
+//
+// Entries are only added and changed while the directory
+// they belong to is locked: dirlookup() adds what it found,
+// dirlink() records a new name, and sys_unlink() forgets a
+// removed one.  Lookups without the directory lock see either
+// the state before or after such a change.
+//
+// A directory's names are forgotten when iput() frees it, not
+// when it is unlinked: a process whose current directory it
+// was can still look names up in it until then.
+//
+// Interface:
+// * dcachelookup() returns 1 and the inum for a cached name,
+//   0 for a name known to be absent, -1 if it doesn't know.
+// * dcacheenter() records a lookup result.
+// * dcacheforget() drops one name; dcacheforgetdir() all
+//   names of a directory that is being freed.
+//
+// Names of DNAMELEN bytes or more are never cached, which
+// keeps the entries small; lookups of them miss.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+
+#define NDHASH 61
+#define DNAMELEN 32
+
+struct dentry {
+  uint dev;
+  uint parent;          // inum of the directory; 0 if unused
+  uint inum;            // 0 for a negative entry
+  char name[DNAMELEN];
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+} dcache;
+
+static uint
+dhash(uint dev, uint parent, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + parent;
+  for(i = 0; i < DNAMELEN && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Move d to the front (most recently used end) of the LRU list.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Remove d from its hash chain and make it the next to recycle.
+static void
+dremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->parent, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->parent = 0;
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->prev = dcache.head.prev;
+  d->next = &dcache.head;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+static struct dentry*
+dfind(uint dev, uint parent, char *name)
+{
+  struct dentry *d;
+
+  if(strlen(name) >= DNAMELEN)
+    return 0;
+  for(d = dcache.hash[dhash(dev, parent, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->parent == parent && strncmp(name, d->name, DNAMELEN) == 0)
+      return d;
+  return 0;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+int
+dcachelookup(uint dev, uint parent, char *name, uint *pinum)
+{
+  struct dentry *d;
+  int r;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, parent, name)) == 0){
+    release(&dcache.lock);
+    return -1;
+  }
+  dtouch(d);
+  *pinum = d->inum;
+  r = d->inum != 0;
+  release(&dcache.lock);
+  return r;
+}
+
+// Record that name in directory parent refers to inum,
+// or (if inum is 0) that there is no such name.
+// Caller must hold the directory's lock.
+void
+dcacheenter(uint dev, uint parent, char *name, uint inum)
+{
+  struct dentry *d;
+
+  if(strlen(name) >= DNAMELEN)
+    return;
+  acquire(&dcache.lock);
+  if((d = dfind(dev, parent, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->parent != 0)
+      dremove(d);
+    d->dev = dev;
+    d->parent = parent;
+    safestrcpy(d->name, name, DNAMELEN);
+    d->hnext = dcache.hash[dhash(dev, parent, name)];
+    dcache.hash[dhash(dev, parent, name)] = d;
+  }
+  d->inum = inum;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget name in directory parent.
+// Caller must hold the directory's lock.
+void
+dcacheforget(uint dev, uint parent, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, parent, name)) != 0)
+    dremove(d);
+  release(&dcache.lock);
+}
+
+// Forget all names in directory parent, which iput() is
+// freeing, so that its inum can be reused.
+void
+dcacheforgetdir(uint dev, uint parent)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->parent == parent && d->dev == dev)
+      dremove(d);
+  release(&dcache.lock);
+}
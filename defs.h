@@ -1,27 +1,55 @@
 struct buf;
+struct callout;
 struct context;
+struct epoll;
+struct epoll_event;
 struct file;
 struct inode;
+struct iovec;
+struct lockstat;
+struct logstat;
 struct pipe;
+struct pollent;
+struct pollfd;
+struct pollq;
 struct proc;
 struct rtcdate;
+struct seqcount;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct waitq;
 
 // bio.c
 void            binit(void);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+struct buf*     bnew(uint, uint);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
+// callout.c
+void            calloutadd(struct callout*, uint, void (*)(struct callout*), void*);
+void            calloutdel(struct callout*);
+void            callouttick(void);
+int             sleepticks(int);
+int             nanosleep(int, int);
+
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(uint, uint, char*, uint*);
+void            dcacheenter(uint, uint, char*, uint);
+void            dcacheforget(uint, uint, char*);
+void            dcacheforgetdir(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -31,16 +59,22 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filesend(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollent*);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
+int             isdirempty(struct inode*);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -52,8 +86,10 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             iwriteblocks(int);
+int             iwritemax(void);
 
-// ide.c
+// ide.c, memide.c or virtio.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
@@ -85,7 +121,24 @@ void            microdelay(int);
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+void            end_opn(int);
+int             log_opmax(void);
+void            log_sync(void);
+void            logflush(void);
+void            logstat(struct logstat*);
+
+// mmap.c
+void            pageinit(void);
+int             pageio(struct inode*, char*, uint, uint, int);
+void            pagedrop(struct inode*);
+int             mmap(struct file*, uint, int, int, uint);
+int             munmap(uint, uint);
+void            munmapall(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+int             mmapfault(uint, int);
+int             mmapcheck(uint, uint, int);
 
 // mp.c
 extern int      ismp;
@@ -95,11 +148,31 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+uint            pciconfread(uint, int);
+void            pciconfwrite(uint, int, uint);
+void            pcienable(uint);
+int             pcifindclass(int, int, uint*);
+int             pcifinddev(int, int, uint*);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipesize(struct pipe*, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
+
+// poll.c
+void            pollinit(void);
+void            pollrecord(struct pollq*, struct pollent*);
+void            pollwake(struct pollq*, int);
+int             poll(struct pollfd*, int, int);
+struct epoll*   epollalloc(void);
+void            epollclose(struct epoll*);
+int             epollctl(struct epoll*, int, struct file*, struct epoll_event*);
+int             epollwait(struct epoll*, struct epoll_event*, int, int);
+int             epollpoll(struct epoll*);
 
 //PAGEBREAK: 16
 // proc.c
@@ -107,15 +180,19 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(void (*)(void), char*);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            setprocname(struct proc*, char*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 int             gettime(int*, int*,int*);
 void            wakeup(void*);
+void            wqsleep(struct waitq*, struct spinlock*);
+void            wqwakeup(struct waitq*);
 void            yield(void);
 int             getque(int*,int*);
 
@@ -127,9 +204,15 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(void);
+struct lockstat* lockstatfor(char*);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
+uint            seqbegin(struct seqcount*);
+int             seqretry(struct seqcount*, uint);
+void            seqwbegin(struct seqcount*);
+void            seqwend(struct seqcount*);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -149,6 +232,8 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argrptr(int, char**, int);
+int             checkptr(uint, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -156,8 +241,10 @@ void            syscall(void);
 
 // timer.c
 void            timerinit(void);
+void            timerwait(void);
 
 // trap.c
+extern int      diskirq;
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
@@ -168,7 +255,14 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// vdso.c
+void            vdsoinit(void);
+int             vdsomap(pde_t*, int);
+void            vdsotick(uint, uint);
+void            vdsounmap(pde_t*);
+
 // vm.c
+extern int      sysenterok;
 void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
@@ -183,6 +277,7 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+uint*           walkpgdir(pde_t*, const void*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
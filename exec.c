@@ -65,6 +65,8 @@ exec(char *path, char **argv)
     goto bad;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
+  if(vdsomap(pgdir, proc->pid) < 0)
+    goto bad;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
@@ -89,9 +91,10 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(proc->name, last, sizeof(proc->name));
+  setprocname(proc, last);
 
   // Commit to the user image.
+  munmapall(proc);
   oldpgdir = proc->pgdir;
   proc->pgdir = pgdir;
   proc->sz = sz;
@@ -2,3 +2,16 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800
+
+// mmap()
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+#define MAP_SHARED   0x1
+#define MAP_PRIVATE  0x2
+
+// fcntl()
+#define F_GETPIPE_SZ 1
+#define F_SETPIPE_SZ 2
+#define F_GETFL      3
+#define F_SETFL      4
@@ -5,10 +5,15 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "fs.h"
+#include "stat.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
+#include "fcntl.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -72,6 +77,8 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
+  else if(ff.type == FD_EPOLL)
+    epollclose(ff.ep);
   else if(ff.type == FD_INODE){
     begin_op();
     iput(ff.ip);
@@ -92,66 +99,223 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
-// Read from file f.
+// Report which of POLLIN, POLLOUT and POLLHUP hold for f,
+// and if e is not 0, have it woken when that may change.
+// Files and directories never make anyone wait, so only
+// pipes and devices have anything to wake.
 int
-fileread(struct file *f, char *addr, int n)
+filepoll(struct file *f, struct pollent *e)
 {
+  struct inode *ip;
   int r;
 
+  switch(f->type){
+  case FD_PIPE:
+    return pipepoll(f->pipe, f->writable, e);
+  case FD_INODE:
+    ip = f->ip;
+    r = POLLIN | POLLOUT;
+    if(ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV &&
+       devsw[ip->major].poll)
+      r = devsw[ip->major].poll(ip, e);
+    if(!f->readable)
+      r &= ~POLLIN;
+    if(!f->writable)
+      r &= ~POLLOUT;
+    return r;
+  case FD_EPOLL:
+    return epollpoll(f->ep);
+  default:
+    return 0;
+  }
+}
+
+// Read from file f into the n buffers iov, at offset off,
+// or at and past f->off if off is negative.
+int
+filereadv(struct file *f, struct iovec *iov, int n, int off)
+{
+  int i, r, tot;
+
   if(f->readable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    // Stop at the first short read; a pipe returns what it has.
+    tot = 0;
+    for(i = 0; i < n; i++){
+      if(iov[i].len == 0)
+        continue;
+      if((r = piperead(f->pipe, iov[i].base, iov[i].len, f->flags & O_NONBLOCK)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return tot;
+  }
   if(f->type == FD_INODE){
+    if((f->flags & O_NONBLOCK) && (filepoll(f, 0) & POLLIN) == 0)
+      return -1;
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    tot = 0;
+    for(i = 0; i < n; i++){
+      r = readi(f->ip, iov[i].base, (off < 0 ? f->off : off) + tot, iov[i].len);
+      if(r < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(tot > 0 && off < 0)
+      f->off += tot;
     iunlock(f->ip);
-    return r;
+    return tot;
   }
   panic("fileread");
 }
 
+// Read from file f.
+int
+fileread(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
 //PAGEBREAK!
-// Write to file f.
+// Write the n buffers iov to file f, at offset off, or at
+// and past f->off if off is negative.
 int
-filewrite(struct file *f, char *addr, int n)
+filewritev(struct file *f, struct iovec *iov, int n, int off)
 {
-  int r;
+  int i, r, tot;
 
   if(f->writable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+  tot = 0;
+  for(i = 0; i < n; i++)
+    tot += iov[i].len;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    // Stop at the first short write, which only
+    // a non-blocking pipe makes.
+    tot = 0;
+    for(i = 0; i < n; i++){
+      if(iov[i].len == 0)
+        continue;
+      if((r = pipewrite(f->pipe, iov[i].base, iov[i].len, f->flags & O_NONBLOCK)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return tot;
+  }
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // the maximum log transaction size, and reserve
+    // just what each chunk can write (iwriteblocks()).
+    // a chunk takes its bytes from as many of the
+    // buffers as it needs.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
+    int maxblk = iwritemax();
+    uint pos = off < 0 ? f->off : off;
+    int k = 0, koff = 0;
+    int done = 0;
+    r = 0;
+    while(done < tot){
+      int n1 = tot - done;
+      if(n1 > maxblk*BSIZE - pos%BSIZE)
+        n1 = maxblk*BSIZE - pos%BSIZE;
+      int nblk = (pos%BSIZE + n1 + BSIZE-1) / BSIZE;
+
+      begin_opn(iwriteblocks(nblk));
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      while(n1 > 0){
+        int m = iov[k].len - koff;
+        if(m > n1)
+          m = n1;
+        if((r = writei(f->ip, (char*)iov[k].base + koff, pos, m)) != m)
+          break;
+        pos += m;
+        done += m;
+        n1 -= m;
+        if((koff += m) == iov[k].len){
+          k++;
+          koff = 0;
+        }
+      }
+      if(off < 0)
+        f->off = pos;
       iunlock(f->ip);
-      end_op();
+      end_opn(iwriteblocks(nblk));
 
       if(r < 0)
         break;
-      if(r != n1)
+      if(n1 > 0)
         panic("short filewrite");
-      i += r;
     }
-    return i == n ? n : -1;
+    return done == tot ? tot : -1;
   }
   panic("filewrite");
 }
 
+// Write to file f.
+int
+filewrite(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+
+// Move up to n bytes from file in to file out, at and past
+// their offsets, without going through user space.  The data
+// crosses a page at a time, through a kernel buffer, so that
+// no lock of one file is held while waiting for the other.
+// Stops early at the end of in, or after a short read from a
+// pipe or device.  Returns the number of bytes moved.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int tot, m, r;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread(in, buf, m)) <= 0)
+      break;
+    if(filewrite(out, buf, r) != r){
+      r = -1;
+      break;
+    }
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  kfree(buf);
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
+}
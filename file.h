@@ -1,13 +1,39 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
+  int flags;  // O_NONBLOCK
   struct pipe *pipe;
   struct inode *ip;
+  struct epoll *ep;
   uint off;
 };
 
+// Something that waits in poll() or on an epoll set.
+struct pollwaiter {
+  struct waitq wq;         // sleeping until woken
+  int woken;               // set by pollwake()
+  struct pollent *ready;   // epoll: entries that may be ready
+};
+
+// A waiter's interest in a pipe or device, on its pollq.
+struct pollent {
+  struct pollq *q;         // queue it is on, or 0
+  struct pollent *next;    // next on q
+  int events;              // POLLIN, POLLOUT
+  struct pollwaiter *w;
+  struct file *f;          // epoll: watched file, or 0 for poll()
+  int data;                // epoll: returned with the events
+  int ready;               // epoll: on w->ready
+  struct pollent *rnext;
+};
+
+// Entries to wake when an object may have become ready.
+struct pollq {
+  struct pollent *head;
+};
+
 
 // in-memory copy of an inode
 struct inode {
@@ -16,13 +42,18 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock;
   int flags;          // I_VALID
+  struct inode *hnext; // icache hash chain
+  struct inode *prev;  // LRU list, while ref is 0
+  struct inode *next;
+  int npage;          // pages in the page cache
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint dindirect;
 };
 #define I_VALID 0x2
 
@@ -31,6 +62,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*, struct pollent*);  // 0 if never waits
 };
 
 extern struct devsw devsw[];
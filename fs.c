@@ -44,39 +44,103 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bnew(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// Each bitmap block covers a group of BPB blocks.  In memory,
+// fsalloc keeps a count of each group's free blocks, so that
+// full groups are skipped without being read; a count changes
+// only while its bitmap block is locked.  It also keeps where
+// the next searches for a block without a goal and for an
+// inode should start.  Both cursors are just hints.
+
+static struct {
+  uint nfree[FSSIZE/BPB + 1];
+  uint bnext;
+  uint inext;
+} fsalloc;
+
+// Count the free blocks of each group.
+static void
+ballocinit(int dev)
+{
+  struct buf *bp;
+  uint g, b, bi;
+
+  if(sb.size > FSSIZE)
+    panic("ballocinit: file system larger than FSSIZE");
+  for(g = 0; g * BPB < sb.size; g++){
+    fsalloc.nfree[g] = 0;
+    bp = bread(dev, BBLOCK(g * BPB, sb));
+    for(bi = 0, b = g * BPB; bi < BPB && b < sb.size; bi++, b++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        fsalloc.nfree[g]++;
+    brelse(bp);
+  }
+  fsalloc.bnext = 0;
+  fsalloc.inext = 1;
+}
 
-// Allocate a zeroed disk block.
+// Mark the first free block at or after from in use and
+// return it, wrapping around to the start of the disk.
+// The bitmap is scanned a word (32 blocks) at a time.
 static uint
-balloc(uint dev)
+bfind(uint dev, uint from)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint *w, x, g, ng, i, wi, bit, b;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  ng = (sb.size + BPB - 1) / BPB;
+  g = from / BPB;
+  for(i = 0; i <= ng; i++, g = (g + 1) % ng){
+    if(fsalloc.nfree[g] == 0)
+      continue;
+    bp = bread(dev, BBLOCK(g * BPB, sb));
+    w = (uint*)bp->data;
+    for(wi = (i == 0) ? (from % BPB) / 32 : 0; wi < BPB/32; wi++){
+      x = w[wi];
+      if(i == 0 && wi == (from % BPB) / 32)
+        x |= (1U << (from % 32)) - 1;  // skip the blocks before from
+      if(x == 0xffffffff)
+        continue;
+      for(bit = 0; x & (1U << bit); bit++)
+        ;
+      b = g * BPB + wi * 32 + bit;
+      if(b >= sb.size)
+        break;
+      w[wi] |= 1U << bit;  // Mark block in use.
+      fsalloc.nfree[g]--;
+      log_write(bp);
+      brelse(bp);
+      return b;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block: goal if it is free, else
+// the nearest free block after it.  Without a goal, carry
+// on from the previous such allocation.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  if(goal != 0 && goal < sb.size)
+    b = bfind(dev, goal);
+  else {
+    b = bfind(dev, fsalloc.bnext);
+    fsalloc.bnext = b + 1;
+  }
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -84,13 +148,13 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
-  readsb(dev, &sb);
   bp = bread(dev, BBLOCK(b, sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  fsalloc.nfree[b / BPB]++;
   log_write(bp);
   brelse(bp);
 }
@@ -120,18 +184,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, iput() frees if
 //   the link count has fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() to find or
-//   create a cache entry and increment its ref, iput()
-//   to decrement ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and
+//   current directories). iget() to find or create a
+//   cache entry and increment its ref, iput() to decrement
+//   ref. An entry whose ref is zero stays cached, on an
+//   LRU list, until iget() needs to recycle it.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when the I_VALID bit
 //   is set in ip->flags. ilock() reads the inode from
 //   the disk and sets I_VALID, while iput() clears
-//   I_VALID if ip->ref has fallen to zero.
+//   I_VALID when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,50 +219,121 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+// Cached inodes are found through a hash table of chains.
+// The unreferenced ones are also on an LRU list; when that
+// list is empty, iget() adds a page worth of fresh entries
+// to the cache instead of failing.
+#define NIHASH 61
+#define IPERPAGE (PGSIZE / sizeof(struct inode))
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+
+  // Linked list of unreferenced inodes, through prev/next.
+  // head.next is most recently used.
+  struct inode head;
 } icache;
 
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIHASH;
+}
+
+// Put the unreferenced inode ip at the front of the LRU list.
+// Caller must hold icache.lock.
+static void
+ilruadd(struct inode *ip)
+{
+  ip->next = icache.head.next;
+  ip->prev = &icache.head;
+  icache.head.next->prev = ip;
+  icache.head.next = ip;
+}
+
+static void
+ilruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Add a page of new, unreferenced entries to the cache.
+// Caller must hold icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  for(ip = (struct inode*)mem; ip < (struct inode*)mem + IPERPAGE; ip++){
+    initsleeplock(&ip->lock, "inode");
+    ilruadd(ip);
+  }
+  return 0;
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  icache.head.prev = &icache.head;
+  icache.head.next = &icache.head;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    ilruadd(&icache.inode[i]);
   }
+  dcacheinit();
   
   readsb(dev, &sb);
+  if(sb.bsize != BSIZE)
+    panic("iinit: file system block size differs from BSIZE");
+  ballocinit(dev);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 //PAGEBREAK!
 // Allocate a new inode with the given type on device dev.
-// A free inode has a type of zero.
+// A free inode has a type of zero.  The search starts after
+// the previously allocated inode and looks at a whole block
+// of inodes per bread().
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  inum = fsalloc.inext;
+  for(n = 0; n < sb.ninodes; ){
+    if(inum == 0 || inum >= sb.ninodes)
+      inum = 1;
     bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
+    do {
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        brelse(bp);
+        fsalloc.inext = inum + 1;
+        return iget(dev, inum);
+      }
+      inum++;
+      n++;
+    } while(inum % IPB != 0 && inum < sb.ninodes);
     brelse(bp);
   }
   panic("ialloc: no inodes");
@@ -218,7 +353,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->dindirect = ip->dindirect;
   log_write(bp);
   brelse(bp);
 }
@@ -229,31 +365,38 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[ihash(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry.
+  if(icache.head.prev == &icache.head && igrow() < 0)
     panic("iget: no inodes");
+  ip = icache.head.prev;
+  ilruremove(ip);
+  if(ip->inum != 0){
+    for(pp = &icache.hash[ihash(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+    pagedrop(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->hnext = icache.hash[ihash(dev, inum)];
+  icache.hash[ihash(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -291,7 +434,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->dindirect = dip->dindirect;
     brelse(bp);
     ip->flags |= I_VALID;
     if(ip->type == 0)
@@ -311,7 +455,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, least recently released first.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -323,13 +467,19 @@ iput(struct inode *ip)
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
     release(&icache.lock);
+    // A process may have looked names up in a removed directory
+    // it was in, so forget them only now that the inum can't
+    // be used until ialloc() hands it out again.
+    if(ip->type == T_DIR)
+      dcacheforgetdir(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     acquire(&icache.lock);
     ip->flags = 0;
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    ilruadd(ip);
   release(&icache.lock);
 }
 
@@ -345,35 +495,85 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk. The first blocks are listed as
+// extents, runs of consecutive blocks, in ip->ext[].  A file
+// grows by extending its last extent when the next disk block
+// is free, and otherwise by starting a new one.  When all
+// NEXTENT extents are in use, the following NDINDIRECT blocks
+// are listed in the indirect blocks that block ip->dindirect
+// lists; from then on the extents no longer change.
+
+// Where to put the first block of ip's file.  Files are
+// spread over the data blocks in inum order, so that each
+// starts with free space to grow into contiguously.
+static uint
+bgoal(struct inode *ip)
+{
+  uint dstart;
+
+  dstart = sb.bmapstart + sb.size/BPB + 1;
+  return dstart + ip->inum * ((sb.size - dstart) / sb.ninodes);
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one.  Files have
+// no holes, so bn is at most the number of blocks ip has.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, off, goal, *a;
+  struct extent *e;
   struct buf *bp;
+  int i;
+
+  off = 0;
+  for(i = 0; i < NEXTENT && ip->ext[i].len > 0; i++){
+    e = &ip->ext[i];
+    if(bn < off + e->len)
+      return e->start + (bn - off);
+    off += e->len;
+  }
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  addr = 0;
+  if(ip->dindirect == 0){
+    if(bn != off)
+      panic("bmap: hole");
+    goal = i > 0 ? ip->ext[i-1].start + ip->ext[i-1].len : bgoal(ip);
+    addr = balloc(ip->dev, goal);
+    if(i > 0 && addr == goal){
+      ip->ext[i-1].len++;
+      return addr;
+    }
+    if(i < NEXTENT){
+      ip->ext[i].start = addr;
+      ip->ext[i].len = 1;
+      return addr;
+    }
+    // Out of extents; addr will be the first block
+    // reached through the double-indirect block.
+    ip->dindirect = balloc(ip->dev, 0);
   }
-  bn -= NDIRECT;
+  bn -= off;
+
+  if(bn < NDINDIRECT){
+    // Load the indirect block, allocating if necessary.
+    bp = bread(ip->dev, ip->dindirect);
+    a = (uint*)bp->data;
+    if((goal = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = goal = balloc(ip->dev, 0);
+      log_write(bp);
+    }
+    brelse(bp);
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
+    bp = bread(ip->dev, goal);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if(a[bn % NINDIRECT] == 0){
+      if(addr == 0)
+        addr = balloc(ip->dev, bn % NINDIRECT ? a[bn % NINDIRECT - 1] + 1 : 0);
+      a[bn % NINDIRECT] = addr;
       log_write(bp);
     }
+    addr = a[bn % NINDIRECT];
     brelse(bp);
     return addr;
   }
@@ -389,31 +589,40 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  int i, j, k;
+  struct buf *bp, *ibp;
+  uint b, *a, *ia;
+
+  for(i = 0; i < NEXTENT; i++){
+    for(b = 0; b < ip->ext[i].len; b++)
+      bfree(ip->dev, ip->ext[i].start + b);
+    ip->ext[i].start = 0;
+    ip->ext[i].len = 0;
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  if(ip->dindirect){
+    bp = bread(ip->dev, ip->dindirect);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+      if(a[j] == 0)
+        continue;
+      ibp = bread(ip->dev, a[j]);
+      ia = (uint*)ibp->data;
+      for(k = 0; k < NINDIRECT; k++){
+        if(ia[k])
+          bfree(ip->dev, ia[k]);
+      }
+      brelse(ibp);
+      bfree(ip->dev, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->dindirect);
+    ip->dindirect = 0;
   }
 
   ip->size = 0;
   iupdate(ip);
+  pagedrop(ip);
 }
 
 // Copy stat information from inode.
@@ -447,8 +656,10 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(pageio(ip, dst, off, m, 0))
+      continue;
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     /*
     cprintf("data off %d:\n", off);
     for (int j = 0; j < min(m, 10); j++) {
@@ -462,6 +673,30 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// The most log blocks a writei() of nblk blocks can dirty:
+// each data block and the bitmap block that records it, the
+// same for each indirect block the data is reached through
+// and for the double-indirect block, and the inode.
+int
+iwriteblocks(int nblk)
+{
+  return 2*nblk + 2*(nblk/NINDIRECT + 2) + 2 + 1;
+}
+
+// The most blocks one transaction can writei(), so that
+// iwriteblocks() of them fits in log_opmax().
+int
+iwritemax(void)
+{
+  int n;
+
+  for(n = log_opmax() / 2; n > 0 && iwriteblocks(n) > log_opmax(); n--)
+    ;
+  if(n == 0)
+    panic("iwritemax: log too small");
+  return n;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 int
@@ -487,6 +722,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
+    pageio(ip, src, off, m, 1);
   }
 
   if(n > 0 && off > ip->size){
@@ -505,41 +741,450 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Every record stores the hash of its name, and names are
+// spread over the blocks of an indexed directory by it.
+// mkfs uses the same function.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
+
+// Look for name, of length len and hash h, among the records
+// of directory block bp.  Return its offset in the block, or -1.
+static int
+dirscan(struct buf *bp, char *name, int len, uint h)
+{
+  struct dirent *de;
+  uint off;
+
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = (struct dirent*)(bp->data + off);
+    if(de->reclen == 0)
+      panic("dirscan");
+    if(de->inum != 0 && de->hash == h && de->namelen == len &&
+       memcmp(de->name, name, len) == 0)
+      return off;
+  }
+  return -1;
+}
+
+// Make bp an empty directory block.
+static void
+dirinit(struct buf *bp)
+{
+  memset(bp->data, 0, BSIZE);
+  ((struct dirent*)bp->data)->reclen = BSIZE;
+}
+
+// Slide the records in use in directory block bp to its
+// start, so that its free space is all at the end.
+static void
+dircompact(struct buf *bp)
+{
+  struct dirent *de, *last;
+  uint off, next, n, w;
+
+  last = 0;
+  w = 0;
+  for(off = 0; off < BSIZE; off = next){
+    de = (struct dirent*)(bp->data + off);
+    next = off + de->reclen;
+    if(de->inum == 0)
+      continue;
+    n = DIRREC(de->namelen);
+    memmove(bp->data + w, de, n);
+    last = (struct dirent*)(bp->data + w);
+    last->reclen = n;
+    w += n;
+  }
+  if(last == 0)
+    dirinit(bp);
+  else
+    last->reclen += BSIZE - w;
+}
+
+// Make room for a record of n bytes in directory block bp,
+// in an unused record or in the spare space of one in use,
+// compacting the block if the free space is scattered.
+// Return the offset of the new record, whose reclen is set,
+// or -1 if the block is full.
+static int
+dirfit(struct buf *bp, uint n)
+{
+  struct dirent *de, *nde;
+  uint off, used, nfree;
+
+  nfree = 0;
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = (struct dirent*)(bp->data + off);
+    used = de->inum ? DIRREC(de->namelen) : 0;
+    nfree += de->reclen - used;
+    if(de->reclen - used < n)
+      continue;
+    if(used == 0)
+      return off;
+    nde = (struct dirent*)(bp->data + off + used);
+    nde->reclen = de->reclen - used;
+    de->reclen = used;
+    return off + used;
+  }
+  if(nfree < n)
+    return -1;
+  dircompact(bp);
+  return dirfit(bp, n);
+}
+
+// Fill in the record at offset off of directory block bp.
+static void
+dirset(struct buf *bp, uint off, char *name, int len, uint h, uint inum)
+{
+  struct dirent *de;
+
+  de = (struct dirent*)(bp->data + off);
+  de->inum = inum;
+  de->hash = h;
+  de->namelen = len;
+  memmove(de->name, name, len);
+}
+
+// Return the index header in the first block bp of a
+// directory, or 0 if the directory isn't indexed.
+static struct dxhead*
+dxhead(struct buf *bp)
+{
+  struct dirent *de;
+  struct dxhead *dh;
+
+  de = (struct dirent*)(bp->data + DXREC);
+  dh = (struct dxhead*)de->name;
+  if(de->inum != 0 || de->reclen != BSIZE - DXREC || dh->magic != DX_MAGIC)
+    return 0;
+  return dh;
+}
+
+static struct dxentry*
+dxentry(struct buf *bp)
+{
+  return (struct dxentry*)(bp->data + DXREC + sizeof(struct dirent) + sizeof(struct dxhead));
+}
+
+// Return the index entry for the block that holds
+// names with hash h.  Entry 0 starts at hash 0.
+static int
+dxfind(struct dxentry *e, int count, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = count - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+static int
+dxindexed(struct inode *dp)
+{
+  struct buf *bp;
+  int r;
+
+  if(dp->size < 2*BSIZE)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  r = dxhead(bp) != 0;
+  brelse(bp);
+  return r;
+}
+
+// Look for name in the indexed directory dp, reading just
+// the first block and the block its index points to.
+// Return the inum, or 0 if there is no such name.
+// If found, set *poff to byte offset of entry.
+static uint
+dxlookup(struct inode *dp, char *name, int len, uint h, uint *poff)
+{
+  struct buf *bp;
+  uint blk, inum;
+  struct dxentry *e;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  blk = 0;
+  // "." and ".." stay in the first block.
+  if((i = dirscan(bp, name, len, h)) < 0){
+    e = dxentry(bp);
+    blk = e[dxfind(e, dxhead(bp)->count, h)].blk;
+    brelse(bp);
+    bp = bread(dp->dev, bmap(dp, blk));
+    i = dirscan(bp, name, len, h);
+  }
+  inum = 0;
+  if(i >= 0){
+    inum = ((struct dirent*)(bp->data + i))->inum;
+    *poff = blk*BSIZE + i;
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Turn dp, a linear directory whose single block is full,
+// into an indexed one: move all names but "." and ".." to
+// a second block, and make that block the index's only entry.
+static void
+dxconvert(struct inode *dp)
+{
+  struct buf *bp, *lbp;
+  struct dirent *de;
+  struct dxhead *dh;
+  struct dxentry *e;
+  uint off, addr, dot, dotdot;
+
+  addr = bmap(dp, 1);
+  bp = bread(dp->dev, bmap(dp, 0));
+  lbp = bread(dp->dev, addr);
+  dirinit(lbp);
+
+  // "." and ".." are the first two records.
+  de = (struct dirent*)bp->data;
+  dot = de->inum;
+  off = de->reclen;
+  de = (struct dirent*)(bp->data + off);
+  dotdot = de->inum;
+  for(off += de->reclen; off < BSIZE; off += de->reclen){
+    de = (struct dirent*)(bp->data + off);
+    if(de->inum != 0)
+      dirset(lbp, dirfit(lbp, DIRREC(de->namelen)), de->name,
+             de->namelen, de->hash, de->inum);
+  }
+
+  memset(bp->data, 0, BSIZE);
+  dirset(bp, 0, ".", 1, dxhash("."), dot);
+  ((struct dirent*)bp->data)->reclen = DIRREC(1);
+  dirset(bp, DIRREC(1), "..", 2, dxhash(".."), dotdot);
+  ((struct dirent*)(bp->data + DIRREC(1)))->reclen = DXREC - DIRREC(1);
+  de = (struct dirent*)(bp->data + DXREC);
+  de->reclen = BSIZE - DXREC;
+  dh = (struct dxhead*)de->name;
+  dh->magic = DX_MAGIC;
+  dh->count = 1;
+  e = dxentry(bp);
+  e[0].hash = 0;
+  e[0].blk = 1;
+  log_write(bp);
+  log_write(lbp);
+  brelse(lbp);
+  brelse(bp);
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+}
+
+// Bytes of the records in directory block bp, plus a new
+// record of n bytes with hash h, whose hashes are below s.
+static uint
+dxbelow(struct buf *bp, uint h, uint n, uint s)
+{
+  struct dirent *de;
+  uint off, tot;
+
+  tot = h < s ? n : 0;
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = (struct dirent*)(bp->data + off);
+    if(de->inum != 0 && de->hash < s)
+      tot += DIRREC(de->namelen);
+  }
+  return tot;
+}
+
+// Consider splitting at hash s for dxsplit(): keep it in
+// *best if it comes closest yet to halving the tot bytes.
+static void
+dxtry(struct buf *bp, uint h, uint n, uint tot, uint s, uint *best, uint *bestd)
+{
+  uint below, d;
+
+  below = dxbelow(bp, h, n, s);
+  d = 2*below > tot ? 2*below - tot : tot - 2*below;
+  if(below > 0 && d < *bestd){
+    *best = s;
+    *bestd = d;
+  }
+}
+
+// Choose the hash at which to split the full directory
+// block bp, about to take a new record of n bytes with hash
+// h: the one dividing the records most evenly by size,
+// without separating records of equal hash.  Return 0 if
+// all of them have the same hash.
+static uint
+dxsplit(struct buf *bp, uint h, uint n)
+{
+  struct dirent *de;
+  uint off, tot, best, bestd;
+
+  tot = n;
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = (struct dirent*)(bp->data + off);
+    if(de->inum != 0)
+      tot += DIRREC(de->namelen);
+  }
+  best = 0;
+  bestd = 0xffffffff;
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = (struct dirent*)(bp->data + off);
+    if(de->inum != 0)
+      dxtry(bp, h, n, tot, de->hash, &best, &bestd);
+  }
+  dxtry(bp, h, n, tot, h, &best, &bestd);
+  return best;
+}
+
+// Add (name, inum) to the indexed directory dp.  If the
+// block the name belongs in is full, move the upper part of
+// its hashes to a new block first.  Return -1 if the index
+// or the directory can't grow any further.
+static int
+dxlink(struct inode *dp, char *name, int len, uint h, uint inum)
+{
+  struct buf *bp, *lbp, *nbp;
+  struct dxhead *dh;
+  struct dxentry *e;
+  struct dirent *de;
+  uint blk, nblk, split;
+  int i, n, off;
+
+  n = DIRREC(len);
+  bp = bread(dp->dev, bmap(dp, 0));
+  dh = dxhead(bp);
+  e = dxentry(bp);
+  i = dxfind(e, dh->count, h);
+  blk = e[i].blk;
+  lbp = bread(dp->dev, bmap(dp, blk));
+
+  if((off = dirfit(lbp, n)) == -1){
+    nblk = dp->size / BSIZE;
+    if(dh->count == DXMAX || nblk >= MAXFILE || (split = dxsplit(lbp, h, n)) == 0){
+      brelse(lbp);
+      brelse(bp);
+      return -1;
+    }
+    nbp = bread(dp->dev, bmap(dp, nblk));
+    dirinit(nbp);
+    for(off = 0; off < BSIZE; off += de->reclen){
+      de = (struct dirent*)(lbp->data + off);
+      if(de->inum != 0 && de->hash >= split){
+        dirset(nbp, dirfit(nbp, DIRREC(de->namelen)), de->name,
+               de->namelen, de->hash, de->inum);
+        de->inum = 0;
+      }
+    }
+    dircompact(lbp);
+    memmove(&e[i+2], &e[i+1], (dh->count - i - 1) * sizeof(*e));
+    e[i+1].hash = split;
+    e[i+1].blk = nblk;
+    dh->count++;
+    log_write(bp);
+    log_write(lbp);
+    log_write(nbp);
+    dp->size += BSIZE;
+    iupdate(dp);
+
+    if(h >= split){
+      brelse(lbp);
+      lbp = nbp;
+    } else
+      brelse(nbp);
+    if((off = dirfit(lbp, n)) == -1){
+      brelse(lbp);
+      brelse(bp);
+      return -1;
+    }
+  }
+
+  dirset(lbp, off, name, len, h, inum);
+  log_write(lbp);
+  brelse(lbp);
+  brelse(bp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Callers that don't need the offset may be answered
+// from the dentry cache; every answer read from the
+// directory itself is remembered there.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, inum, b, h;
+  struct buf *bp;
+  int i, len;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
+  if(poff == 0){
+    switch(dcachelookup(dp->dev, dp->inum, name, &inum)){
+    case 0:
+      return 0;
+    case 1:
       return iget(dp->dev, inum);
     }
   }
 
-  return 0;
+  len = strlen(name);
+  h = dxhash(name);
+  inum = off = 0;
+  if(dxindexed(dp))
+    inum = dxlookup(dp, name, len, h, &off);
+  else {
+    for(b = 0; b < dp->size / BSIZE && inum == 0; b++){
+      bp = bread(dp->dev, bmap(dp, b));
+      if((i = dirscan(bp, name, len, h)) >= 0){
+        // entry matches path element
+        inum = ((struct dirent*)(bp->data + i))->inum;
+        off = b*BSIZE + i;
+      }
+      brelse(bp);
+    }
+  }
+
+  dcacheenter(dp->dev, dp->inum, name, inum);
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// A linear directory is indexed once its first block is full;
+// one that already spans several blocks stays linear.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
   struct inode *ip;
+  struct buf *bp;
+  uint b, h;
+  int len, off;
+
+  off = 0;
+  bp = 0;
+
+  // A removed directory takes no new names.
+  if(dp->nlink == 0)
+    return -1;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -547,22 +1192,82 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  len = strlen(name);
+  if(len == 0 || len > DIRSIZ)
+    return -1;
+  h = dxhash(name);
+
+  if(!dxindexed(dp)){
+    // Look for room in a block, or add one.
+    for(b = 0; b < dp->size / BSIZE; b++){
+      bp = bread(dp->dev, bmap(dp, b));
+      if((off = dirfit(bp, DIRREC(len))) >= 0)
+        break;
+      brelse(bp);
+    }
+
+    if(b < dp->size / BSIZE || dp->size != BSIZE){
+      if(b == dp->size / BSIZE){
+        bp = bread(dp->dev, bmap(dp, b));
+        dirinit(bp);
+        off = 0;
+        dp->size += BSIZE;
+        iupdate(dp);
+      }
+      dirset(bp, off, name, len, h, inum);
+      log_write(bp);
+      brelse(bp);
+      dcacheenter(dp->dev, dp->inum, name, inum);
+      return 0;
+    }
+    dxconvert(dp);
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+  if(dxlink(dp, name, len, h, inum) < 0)
+    return -1;
+  dcacheenter(dp->dev, dp->inum, name, inum);
 
   return 0;
 }
 
+// Remove the entry at byte offset off of directory dp,
+// as found by dirlookup().
+void
+dirunlink(struct inode *dp, uint off)
+{
+  struct buf *bp;
+
+  bp = bread(dp->dev, bmap(dp, off / BSIZE));
+  ((struct dirent*)(bp->data + off%BSIZE))->inum = 0;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Is the directory dp empty except for "." and ".." ?
+int
+isdirempty(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint b, off;
+  int empty;
+
+  empty = 1;
+  for(b = 0; b < dp->size / BSIZE && empty; b++){
+    bp = bread(dp->dev, bmap(dp, b));
+    for(off = 0; off < BSIZE; off += de->reclen){
+      de = (struct dirent*)(bp->data + off);
+      // "." and ".." are the first records, ahead of DXREC.
+      if(de->inum != 0 && (b > 0 || off >= DXREC)){
+        empty = 0;
+        break;
+      }
+    }
+    brelse(bp);
+  }
+  return empty;
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -570,7 +1275,8 @@ dirlink(struct inode *dp, char *name, uint inum)
 // Return a pointer to the element following the copied one.
 // The returned path has no leading slashes,
 // so the caller can check *path=='\0' to see if the name is the last one.
-// If no name to remove, return 0.
+// If no name to remove, return 0.  A name longer than DIRSIZ
+// is copied as the empty string, which names nothing.
 //
 // Examples:
 //   skipelem("a/bb/c", name) = "bb/c", setting name = "a"
@@ -592,12 +1298,10 @@ skipelem(char *path, char *name)
   while(*path != '/' && *path != 0)
     path++;
   len = path - s;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
-  else {
-    memmove(name, s, len);
-    name[len] = 0;
-  }
+  if(len > DIRSIZ)
+    len = 0;
+  memmove(name, s, len);
+  name[len] = 0;
   while(*path == '/')
     path++;
   return path;
@@ -605,12 +1309,17 @@ skipelem(char *path, char *name)
 
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for DIRSIZ+1 bytes.
 // Must be called inside a transaction since it calls iput().
+// Path elements the dentry cache knows about are resolved
+// without locking or reading the directories; the cache only
+// holds names of directories, so ip must be one.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  uint inum;
+  int r;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -618,6 +1327,32 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(proc->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    if(name[0] == 0){
+      iput(ip);
+      return 0;
+    }
+    if(!nameiparent || *path != '\0'){
+      r = dcachelookup(ip->dev, ip->inum, name, &inum);
+      if(r == 0){
+        iput(ip);
+        return 0;
+      }
+      if(r == 1){
+        // Without ip's lock, name may have been unlinked and
+        // its inode freed and reused since the lookup.  next
+        // can't be freed while it is held, so if name still
+        // refers to it, it is the right inode; if not, look
+        // again with ip locked.
+        next = iget(ip->dev, inum);
+        if(dcachelookup(ip->dev, ip->inum, name, &inum) == 1 &&
+           inum == next->inum){
+          iput(ip);
+          ip = next;
+          continue;
+        }
+        iput(next);
+      }
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -645,7 +1380,7 @@ namex(char *path, int nameiparent, char *name)
 struct inode*
 namei(char *path)
 {
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
   return namex(path, 0, name);
 }
 
@@ -3,7 +3,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 512  // block size; a multiple of 512 (make BSIZE=4096)
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,11 +21,24 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes) mkfs built the image with
 };
 
-#define NDIRECT 12
+// A file's blocks are described by up to NEXTENT extents,
+// runs of consecutive disk blocks, in file order.  Once those
+// are used up, the blocks that follow are found through a
+// double-indirect block.  MAXFILE is the size any file can
+// reach, however fragmented; it is kept below 2GB so that
+// byte offsets fit in an int.
+#define NEXTENT 6
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDINDIRECT < 0x80000000 / BSIZE ? NDINDIRECT : 0x80000000 / BSIZE)
+
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks, 0 if unused
+};
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +47,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT];  // Data blocks, in runs
+  uint dindirect;       // Blocks past the extents
 };
 
 // Inodes per block.
@@ -47,11 +63,48 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
 
-// Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+// Directory is a file containing a sequence of variable-length
+// directory records, each a dirent followed by the name, padded
+// to a multiple of 4 bytes.  Records never straddle a block: the
+// last record of a block runs to its end, and reclen takes in any
+// space left over.  A record with inum 0 is unused space.  Names
+// are not nul-terminated on disk, and carry their hash so lookups
+// need only compare names whose hashes match.
+#define DIRSIZ 255  // longest name
 
 struct dirent {
   ushort inum;
-  char name[DIRSIZ];
+  ushort reclen;     // bytes from this record to the next
+  uint hash;         // dxhash() of the name
+  ushort namelen;
+  ushort pad;
+  char name[];       // namelen bytes
 };
 
+// Bytes needed by a record for a name of n bytes.
+#define DIRREC(n)     ((sizeof(struct dirent) + (n) + 3) & ~3)
+
+// A directory that outgrows its first block becomes an indexed
+// directory.  Its first block keeps "." and "..", followed by a
+// record with inum 0, so code that reads a directory record by
+// record just skips it, holding a dxhead and a table of index
+// entries.  The entries are sorted by hash, each naming the
+// directory block that holds the names whose hash lies between
+// its own and the next entry's.  Those blocks hold plain records.
+#define DX_MAGIC 0x78646e69  // "indx"
+
+struct dxhead {
+  uint magic;        // DX_MAGIC
+  uint count;        // index entries in use
+};
+
+struct dxentry {
+  uint hash;         // lowest name hash stored in that block
+  uint blk;          // directory block
+};
+
+// Offset of the index record in the first block.
+#define DXREC         (2*DIRREC(2))
+
+// Index entries that fit in the first block.
+#define DXMAX         ((BSIZE - DXREC - sizeof(struct dirent) - sizeof(struct dxhead)) / sizeof(struct dxentry))
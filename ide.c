@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses the bus-master DMA engine of a
+// PCI IDE controller (such as QEMU's PIIX) when there is one,
+// and PIO through the data port otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -17,19 +19,68 @@
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master IDE registers of the primary channel,
+// relative to the I/O base in BAR4 of the controller.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // transfer from disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+#define PCI_BAR4      0x20
+
+#define SECTPERBLK    (BSIZE/SECTOR_SIZE)
+#define IDE_MULT      16   // sectors per interrupt for READ/WRITE MULTIPLE
+#define IDE_MAXSECT   128  // most sectors a single command may transfer
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
 // You must hold idelock while manipulating queue.
+//
+// idestart() merges the bufs at the head of the queue that
+// cover consecutive blocks into one command; the first
+// idenbuf bufs of idequeue are that command's run.
+// idensect is the length of the run in sectors, idedone
+// how many of them have crossed the data port so far, and
+// idedrq how many sectors the disk moves per interrupt.
+//
+// With DMA, the controller walks idemap, a table of physical
+// regions covering the bufs of the run, and interrupts once
+// when the whole run is in memory or on disk.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenbuf;
+static int idensect;
+static int idedone;
+static int idedrq;
+
+// Physical region descriptor for the DMA engine.
+struct prd {
+  uint addr;      // physical address
+  ushort len;     // byte count, 0 meaning 64K
+  ushort flags;
+};
+#define PRD_EOT  0x8000  // last entry of the table
+
+// Each buf of a run needs at most two entries, since a
+// region may not cross a 64K boundary.  The table itself
+// must not cross one either, hence the page alignment.
+#define NPRD  (2*IDE_MAXSECT)
+static struct prd idemap[NPRD] __attribute__((__aligned__(PGSIZE)));
+static ushort idebm;    // bus-master I/O base, 0 if using PIO
 
 static int havedisk1;
 static void idestart(struct buf*);
@@ -51,6 +102,10 @@ void
 ideinit(void)
 {
   int i;
+  uint tag, bar;
+
+  if(BSIZE % SECTOR_SIZE != 0 || SECTPERBLK > IDE_MAXSECT)
+    panic("ideinit: bad BSIZE");
 
   initlock(&idelock, "ide");
   picenable(IRQ_IDE);
@@ -66,35 +121,147 @@ ideinit(void)
     }
   }
 
+  // Set the DRQ block size that READ/WRITE MULTIPLE use on
+  // disk 1, with the interrupt masked so the completion of
+  // this command isn't mistaken for a queued request.
+  if(havedisk1){
+    idewait(0);
+    outb(0x3f6, 0x02);
+    outb(0x1f2, IDE_MULT);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    idewait(0);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Use DMA if the controller is a PCI bus master.
+  if(pcifindclass(0x01, 0x01, &tag) == 0){
+    bar = pciconfread(tag, PCI_BAR4);
+    if((bar & 1) && (bar & 0xfffc) != 0){
+      pcienable(tag);
+      idebm = bar & 0xfffc;
+      outl(idebm + BM_PRDT, V2P(idemap));
+    }
+  }
+  cprintf("ide: %s\n", idebm ? "bus-master dma" : "pio");
+}
+
+// Describe the bufs of the run to the DMA engine and
+// arm it in the transfer direction of b.
+// Caller must hold idelock.
+static void
+idedmaprep(struct buf *b)
+{
+  struct prd *pd;
+  uint pa, n, end;
+  int i;
+
+  pd = idemap;
+  for(i = 0; i < idenbuf; i++, b = b->qnext){
+    pa = V2P(b->data);
+    end = pa + BSIZE;
+    while(pa < end){
+      n = end - pa;
+      if(n > 0x10000 - (pa & 0xffff))
+        n = 0x10000 - (pa & 0xffff);  // stop at the 64K boundary
+      pd->addr = pa;
+      pd->len = n & 0xffff;
+      pd->flags = 0;
+      pd++;
+      pa += n;
+    }
+  }
+  pd[-1].flags = PRD_EOT;
+
+  outb(idebm + BM_CMD, 0);
+  outb(idebm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);  // write 1 to clear
+}
+
+// Move the next DRQ block of the active command between the
+// data port and the bufs of the run.  Caller must hold idelock.
+static void
+idexfer(void)
+{
+  struct buf *b;
+  int i, n, s, off;
+
+  n = idensect - idedone;
+  if(n > idedrq)
+    n = idedrq;
+
+  b = idequeue;
+  for(s = idedone; s >= SECTPERBLK; s -= SECTPERBLK)
+    b = b->qnext;
+  off = s * SECTOR_SIZE;
+
+  for(i = 0; i < n; i++){
+    if(off == BSIZE){
+      b = b->qnext;
+      off = 0;
+    }
+    if(b->flags & B_DIRTY){
+      while((inb(0x1f7) & (IDE_BSY|IDE_DRQ)) != IDE_DRQ)
+        ;
+      outsl(0x1f0, b->data + off, SECTOR_SIZE/4);
+    } else
+      insl(0x1f0, b->data + off, SECTOR_SIZE/4);
+    off += SECTOR_SIZE;
+  }
+  idedone += n;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b, together with the queued requests
+// right behind it that continue it on disk.  b must be the
+// head of idequeue.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
-  if(b == 0)
+  struct buf *p, *q;
+  int sector, read_cmd, write_cmd;
+
+  if(b == 0 || b != idequeue)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  idenbuf = 1;
+  for(p = b; (q = p->qnext) != 0; p = q){
+    if((idenbuf+1) * SECTPERBLK > IDE_MAXSECT)
+      break;
+    if(q->dev != b->dev || q->blockno != p->blockno + 1)
+      break;
+    if((q->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    idenbuf++;
+  }
+  idensect = idenbuf * SECTPERBLK;
+  idedone = 0;
+  idedrq = (idensect == 1) ? 1 : IDE_MULT;
+
+  sector = b->blockno * SECTPERBLK;
+  read_cmd = (idensect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  write_cmd = (idensect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  if(idebm)
+    idedmaprep(b);
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, idensect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idebm){
+    if(b->flags & B_DIRTY){
+      outb(0x1f7, IDE_CMD_WRDMA);
+      outb(idebm + BM_CMD, BM_CMD_START);
+    } else {
+      outb(0x1f7, IDE_CMD_RDDMA);
+      outb(idebm + BM_CMD, BM_CMD_READ | BM_CMD_START);
+    }
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    idexfer();
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -105,6 +272,7 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int err, st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -113,16 +281,47 @@ ideintr(void)
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  // A DMA run interrupts once, when the data is already
+  // in place; all that is left is to stop the engine.
+  if(idebm){
+    st = inb(idebm + BM_STATUS);
+    if(!(st & BM_ST_INTR)){
+      release(&idelock);
+      return;
+    }
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    err = idewait(1) < 0 || (st & BM_ST_ERR);
+    goto done;
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // The disk interrupts once per DRQ block.  Read the
+  // block that just arrived, or write the next one, and
+  // keep waiting until the whole run has been moved.
+  err = idewait(1) < 0;
+  if(!err && !(b->flags & B_DIRTY))
+    idexfer();
+  if(!err && idedone < idensect){
+    if(b->flags & B_DIRTY)
+      idexfer();
+    release(&idelock);
+    return;
+  }
+
+done:
+  if(err)
+    cprintf("ide: error on block %d\n", b->blockno);
+
+  // Wake the processes waiting for the bufs of the run.
+  while(idenbuf > 0){
+    b = idequeue;
+    idequeue = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wqwakeup(&b->iowait);
+    idenbuf--;
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -139,6 +338,7 @@ void
 iderw(struct buf *b)
 {
   struct buf **pp;
+  int i;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -146,13 +346,26 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
+  if(b->blockno >= FSSIZE)
+    panic("incorrect blockno");
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Append b to idequeue, or slot it in behind a waiting
+  // request for the preceding block so that idestart()
+  // can merge the two.  Never disturb the active run.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+  pp = &idequeue;
+  for(i = 0; *pp && i < idenbuf; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp; pp=&(*pp)->qnext){  //DOC:insert-queue
+    if((*pp)->dev == b->dev && (*pp)->blockno + 1 == b->blockno &&
+       ((*pp)->flags & B_DIRTY) == (b->flags & B_DIRTY)){
+      pp = &(*pp)->qnext;
+      break;
+    }
+  }
+  b->qnext = *pp;
   *pp = b;
 
   // Start disk if necessary.
@@ -161,7 +374,7 @@ iderw(struct buf *b)
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    wqsleep(&b->iowait, &idelock);
   }
 
   release(&idelock);
@@ -43,6 +43,7 @@
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
 volatile uint *lapic;  // Initialized in mp.c
+static uint ticr;      // Timer count per clock tick
 
 static void
 lapicw(int index, int value)
@@ -50,6 +51,24 @@ lapicw(int index, int value)
   lapic[index] = value;
   lapic[ID];  // wait for write to finish, by reading
 }
+
+// Count bus cycles for one tick of the PIT.
+// The boot CPU does this, before any others start;
+// they share its result.
+static uint
+lapiccalibrate(void)
+{
+  uint n;
+
+  lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, 0xFFFFFFFF);
+  timerwait();
+  n = 0xFFFFFFFF - lapic[TCCR];
+  lapicw(TICR, 0);
+  if(n == 0)
+    panic("lapiccalibrate");
+  return n;
+}
 //PAGEBREAK!
 
 void
@@ -63,11 +82,13 @@ lapicinit(void)
 
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // TICR is calibrated against the PIT so that the
+  // interrupt comes HZ times a second.
   lapicw(TDCR, X1);
+  if(ticr == 0)
+    ticr = lapiccalibrate();
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, ticr);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
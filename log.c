@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "logstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -19,6 +20,30 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves room for MAXOPBLOCKS blocks; a call
+// that knows it writes a different number can use
+// begin_opn(n)/end_opn(n) instead.
+//
+// Commits are lazy: the last end_op() leaves the transaction
+// open, its blocks dirty and pinned in the buffer cache, so
+// that later system calls writing the same blocks are absorbed
+// into it.  The transaction is committed when a begin_op()
+// finds the log full, when log_sync() asks for it (the sync
+// and fsync system calls), or every FLUSHTICKS by the logflush
+// kernel thread.
+//
+// mkfs sizes the log to the image, and the kernel uses as
+// much of it as fits in MAXLOGSIZE.
+//
+// Commit is double-buffered.  The committing end_op() first
+// seals the transaction: it copies the logged blocks into
+// cbuf[], the log's private buffers, and opens a fresh
+// transaction.  New system calls join that one while the
+// sealed copy is written to the log and installed; the cached
+// blocks stay pinned (bpin()) until their sealed contents are
+// home.  Only one transaction is written at a time; if the
+// open one becomes committable meanwhile, the committer
+// commits it too before returning.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -33,47 +58,99 @@
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // header plus data blocks
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks reserved by the executing calls
+  int sealing;     // in seal(), please wait.
+  int committing;  // a sealed transaction is in commit().
+  int nwaiting;    // begin_op()s waiting for log space
+  int nsyncing;    // log_sync()s waiting for a commit
+  struct waitq wait;  // where those sleep
+  uint nsealed;    // transactions sealed so far
+  uint ndone;      // transactions committed so far
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // the sealed transaction
+  struct logstat stat;
 };
 struct log log;
 
+// The sealed transaction's blocks, and the cached
+// copies that stay pinned until those are installed.
+static struct buf cbuf[MAXLOGSIZE];
+static struct buf *chome[MAXLOGSIZE];
+
 static void recover_from_log(void);
 static void commit();
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  for (i = 0; i < MAXLOGSIZE; i++)
+    initsleeplock(&cbuf[i].lock, "logbuf");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  if (log.size > MAXLOGSIZE + 1)
+    log.size = MAXLOGSIZE + 1;  // use the front of a bigger log
+  if (log.size - 1 < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log.stat.nlog = log.size - 1;
   log.dev = dev;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Write the sealed copy of block tail of the transaction to
+// disk block blockno, bypassing the buffer cache.
+static void
+cwrite(int tail, uint blockno)
+{
+  struct buf *b = &cbuf[tail];
+
+  acquiresleep(&b->lock);
+  b->dev = log.dev;
+  b->blockno = blockno;
+  b->flags = B_VALID | B_DIRTY;
+  iderw(b);
+  releasesleep(&b->lock);
+}
+
+// Copy committed blocks from the sealed copies to their home
+// location, and unpin the cached blocks.
 static void
 install_trans(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  for (tail = 0; tail < log.clh.n; tail++) {
+    cwrite(tail, log.clh.block[tail]);  // write dst to disk
+    bunpin(chome[tail]);
+  }
+}
+
+// Copy committed blocks from log to their home location,
+// after a crash.
+static void
+replay_trans(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+    struct buf *dbuf = bread(log.dev, log.clh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
     brelse(lbuf);
@@ -83,14 +160,14 @@ install_trans(void)
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  h->n = lh->n;
+  for (i = 0; i < h->n; i++) {
+    h->block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -99,14 +176,14 @@ read_head(void)
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,92 +192,229 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  read_head(&log.clh);
+  replay_trans(); // if committed, copy from log to disk
+  log.clh.n = 0;
+  write_head(&log.clh); // clear the log
 }
 
-// called at the start of each FS system call.
+// The most blocks one operation may reserve: half the log,
+// so that two large operations can share a transaction.
+int
+log_opmax(void)
+{
+  return (log.size - 1) / 2;
+}
+
+// Whether the open transaction should be committed as soon
+// as no system call is executing.  Caller holds log.lock.
+static int
+wantcommit(void)
+{
+  return log.lh.n > 0 && (log.nwaiting > 0 || log.nsyncing > 0);
+}
+
+// Commit the open transaction, and the ones that become
+// committable meanwhile.  Caller has set log.committing
+// and log.sealing, and does not hold log.lock.
+static void
+commitall(void)
+{
+  int do_commit = 1;
+
+  while(do_commit){
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+    acquire(&log.lock);
+    log.ndone++;
+    // Commit the transaction that filled up meanwhile,
+    // since its own last end_op() left it to us.
+    do_commit = log.outstanding == 0 && wantcommit();
+    log.committing = do_commit;
+    log.sealing = do_commit;
+    wqwakeup(&log.wait);
+    release(&log.lock);
+  }
+}
+
+// called at the start of each FS system call
+// that writes at most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  uint t0 = 0;
+  int waited = 0;
+
+  if(n > log.size - 1)
+    panic("begin_op: too many blocks");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+    if(log.sealing ||
+       log.lh.n + log.reserved + n > log.size - 1){
+      // sealing, or this op might exhaust log space;
+      // wait for commit.
+      if(!waited){
+        waited = 1;
+        t0 = ticks;
+        log.stat.nwait++;
+      }
+      if(log.sealing){
+        wqsleep(&log.wait, &log.lock);
+      } else if(!log.committing && log.outstanding == 0){
+        // No end_op() is coming to commit; do it here.
+        log.committing = 1;
+        log.sealing = 1;
+        release(&log.lock);
+        commitall();
+        acquire(&log.lock);
+      } else {
+        log.nwaiting++;
+        wqsleep(&log.wait, &log.lock);
+        log.nwaiting--;
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      if(waited)
+        log.stat.waitticks += ticks - t0;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call, with the n
+// passed to begin_opn().
+// commits if this was the last outstanding operation,
+// someone is waiting for the commit, and no other
+// transaction is being committed.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.sealing)
+    panic("log.sealing");
+  if(log.outstanding == 0 && wantcommit() && !log.committing){
     do_commit = 1;
     log.committing = 1;
+    log.sealing = 1;
   } else {
     // begin_op() may be waiting for log space.
-    wakeup(&log);
+    wqwakeup(&log.wait);
   }
   release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+  if(do_commit)
+    commitall();
+}
+
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Commit the open transaction, waiting for the system calls
+// in it to finish, and return once everything logged before
+// the call is on disk.  Must not be called inside a
+// transaction.
+void
+log_sync(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  target = log.nsealed + (log.lh.n > 0);
+  log.nsyncing++;
+  while((int)(log.ndone - target) < 0){
+    if(!log.sealing && !log.committing && log.outstanding == 0 && log.lh.n > 0){
+      log.committing = 1;
+      log.sealing = 1;
+      release(&log.lock);
+      commitall();
+      acquire(&log.lock);
+    } else
+      wqsleep(&log.wait, &log.lock);
   }
+  log.nsyncing--;
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// The logflush kernel thread: commits whatever the
+// system calls of the last FLUSHTICKS have logged.
+void
+logflush(void)
+{
+  for(;;){
+    sleepticks(FLUSHTICKS);
+    log_sync();
+  }
+}
+
+// Copy the blocks of the open transaction into cbuf[],
+// make it the sealed transaction, and open a new one.
 static void
-write_log(void)
+seal(void)
 {
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    memmove(cbuf[tail].data, from->data, BSIZE);
+    chome[tail] = from;
+    brelse(from);  // still pinned by log_write()
   }
+
+  acquire(&log.lock);
+  log.clh = log.lh;
+  log.lh.n = 0;
+  log.nsealed++;
+  log.stat.ncommit++;
+  log.stat.nblock += log.clh.n;
+  if(log.clh.n > log.stat.maxblock)
+    log.stat.maxblock = log.clh.n;
+  log.sealing = 0;
+  wqwakeup(&log.wait);
+  release(&log.lock);
+}
+
+// Copy the sealed blocks to the log.
+static void
+write_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++)
+    cwrite(tail, log.start+tail+1);  // write the log
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
+  seal();
+  if (log.clh.n > 0) {
+    write_log();     // Write sealed blocks to log
+    write_head(&log.clh);    // Write header to disk -- the real commit
     install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.clh.n = 0;
+    write_head(&log.clh);    // Erase the transaction from the log
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
+// Record the block number and pin it in the cache.
 // commit()/write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
@@ -213,20 +427,32 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
+  log.stat.nwrite++;
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+    if (log.lh.block[i] == b->blockno) {  // log absorbtion
+      log.stat.nabsorb++;
       break;
+    }
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    bpin(b); // prevent eviction
     log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  }
   release(&log.lock);
 }
 
+// Copy the log statistics to *st.
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  release(&log.lock);
+}
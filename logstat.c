@@ -0,0 +1,23 @@
+// Print the file system log's statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "logstat.h"
+
+int
+main(void)
+{
+  struct logstat ls;
+
+  if(logstat(&ls) < 0){
+    printf(2, "logstat: failed\n");
+    exit();
+  }
+  printf(1, "log blocks %d\n", ls.nlog);
+  printf(1, "log writes %d absorbed %d\n", ls.nwrite, ls.nabsorb);
+  printf(1, "commits %d blocks %d largest %d\n",
+         ls.ncommit, ls.nblock, ls.maxblock);
+  printf(1, "begin_op waits %d ticks %d\n", ls.nwait, ls.waitticks);
+  exit();
+}
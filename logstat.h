@@ -0,0 +1,11 @@
+// Log statistics, as returned by the logstat system call.
+struct logstat {
+  uint nlog;        // data blocks in the on-disk log
+  uint nwrite;      // log_write() calls
+  uint nabsorb;     // of those, blocks already in the transaction
+  uint ncommit;     // transactions committed
+  uint nblock;      // blocks written by all commits
+  uint maxblock;    // blocks in the largest commit
+  uint nwait;       // begin_op() calls that had to sleep
+  uint waitticks;   // ticks spent sleeping in begin_op()
+};
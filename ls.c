@@ -3,10 +3,16 @@
 #include "user.h"
 #include "fs.h"
 
+// Names shorter than this are padded to line up the columns.
+#define NAMEW 14
+
+// A directory block, read a whole block at a time.
+char dirbuf[BSIZE];
+
 char*
 fmtname(char *path)
 {
-  static char buf[DIRSIZ+1];
+  static char buf[NAMEW+1];
   char *p;
 
   // Find first character after last slash.
@@ -15,10 +21,10 @@ fmtname(char *path)
   p++;
 
   // Return blank-padded name.
-  if(strlen(p) >= DIRSIZ)
+  if(strlen(p) >= NAMEW)
     return p;
   memmove(buf, p, strlen(p));
-  memset(buf+strlen(p), ' ', DIRSIZ-strlen(p));
+  memset(buf+strlen(p), ' ', NAMEW-strlen(p));
   return buf;
 }
 
@@ -26,8 +32,8 @@ void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, off;
+  struct dirent *de;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -54,16 +60,21 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
+    while(read(fd, dirbuf, BSIZE) == BSIZE){
+      for(off = 0; off < BSIZE; off += de->reclen){
+        de = (struct dirent*)(dirbuf + off);
+        if(de->reclen == 0)
+          break;
+        if(de->inum == 0)
+          continue;
+        memmove(p, de->name, de->namelen);
+        p[de->namelen] = 0;
+        if(stat(buf, &st) < 0){
+          printf(1, "ls: cannot stat %s\n", buf);
+          continue;
+        }
+        printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
       }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
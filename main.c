@@ -29,8 +29,11 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  vdsoinit();      // pages shared with user space
   binit();         // buffer cache
+  pageinit();      // page cache
   fileinit();      // file table
+  pollinit();      // poll() and epoll
   ideinit();       // disk
   if(!ismp)
     timerinit();   // uniprocessor timer
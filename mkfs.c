@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog;     // Log blocks, header included
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -32,6 +32,12 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+// Names to go in the root directory.
+struct rootent {
+  uint inum;
+  char name[DIRSIZ+1];
+} rootde[NINODES];
+
 
 void balloc(int);
 void wsect(uint, void*);
@@ -39,7 +45,9 @@ void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
+uint fbmap(struct dinode *din, uint fbn);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct rootent *de, int n);
 
 // convert to intel byte order
 ushort
@@ -68,10 +76,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  int nroot;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -82,7 +89,8 @@ main(int argc, char *argv[])
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
-  assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(DIRREC(1) == DIRREC(2) && sizeof(struct dirent) % 4 == 0);
+  assert((BSIZE % 512) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -90,6 +98,15 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  // Size the log to the image: a sixteenth of its blocks,
+  // but no less than LOGSIZE and no more than the kernel
+  // can use.
+  nlog = FSSIZE / 16;
+  if(nlog < LOGSIZE)
+    nlog = LOGSIZE;
+  if(nlog > MAXLOGSIZE + 1)
+    nlog = MAXLOGSIZE + 1;
+
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
@@ -101,9 +118,10 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d bsize %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, BSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -117,15 +135,11 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootde[0].inum = rootino;
+  strcpy(rootde[0].name, ".");
+  rootde[1].inum = rootino;
+  strcpy(rootde[1].name, "..");
+  nroot = 2;
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -144,10 +158,11 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nroot < NINODES);
+    assert(strlen(argv[i]) <= DIRSIZ);
+    rootde[nroot].inum = inum;
+    strcpy(rootde[nroot].name, argv[i]);
+    nroot++;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -155,12 +170,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, rootde, nroot);
 
   balloc(freeblock);
 
@@ -252,6 +262,54 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of the file
+// described by din, allocating it if fbn is the block just
+// past the end.  Mirrors bmap() in fs.c.
+uint
+fbmap(struct dinode *din, uint fbn)
+{
+  struct extent *e;
+  uint off, x, dind[NINDIRECT], ind[NINDIRECT];
+  int i;
+
+  off = 0;
+  for(i = 0; i < NEXTENT && xint(din->ext[i].len) > 0; i++){
+    e = &din->ext[i];
+    if(fbn < off + xint(e->len))
+      return xint(e->start) + fbn - off;
+    off += xint(e->len);
+  }
+
+  if(xint(din->dindirect) == 0){
+    assert(fbn == off);
+    if(i > 0 && xint(din->ext[i-1].start) + xint(din->ext[i-1].len) == freeblock){
+      din->ext[i-1].len = xint(xint(din->ext[i-1].len) + 1);
+      return freeblock++;
+    }
+    if(i < NEXTENT){
+      din->ext[i].start = xint(freeblock);
+      din->ext[i].len = xint(1);
+      return freeblock++;
+    }
+    din->dindirect = xint(freeblock++);
+  }
+  fbn -= off;
+  assert(fbn < NDINDIRECT);
+
+  rsect(xint(din->dindirect), (char*)dind);
+  if(dind[fbn / NINDIRECT] == 0){
+    dind[fbn / NINDIRECT] = xint(freeblock++);
+    wsect(xint(din->dindirect), (char*)dind);
+  }
+  x = xint(dind[fbn / NINDIRECT]);
+  rsect(x, (char*)ind);
+  if(ind[fbn % NINDIRECT] == 0){
+    ind[fbn % NINDIRECT] = xint(freeblock++);
+    wsect(x, (char*)ind);
+  }
+  return xint(ind[fbn % NINDIRECT]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +317,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -268,22 +325,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -295,3 +337,122 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Must match dxhash() in fs.c.
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
+
+int
+dxcmp(const void *a, const void *b)
+{
+  uint ha, hb;
+
+  ha = dxhash(((struct rootent*)a)->name);
+  hb = dxhash(((struct rootent*)b)->name);
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the record for (name, inum) at offset off of the
+// directory block buf, and return the offset after it.
+int
+putrec(char *buf, int off, uint inum, char *name)
+{
+  struct dirent *de;
+  int len;
+
+  len = strlen(name);
+  assert(off + DIRREC(len) <= BSIZE);
+  de = (struct dirent*)(buf + off);
+  de->inum = xshort(inum);
+  de->reclen = xshort(DIRREC(len));
+  de->hash = xint(dxhash(name));
+  de->namelen = xshort(len);
+  memmove(de->name, name, len);
+  return off + DIRREC(len);
+}
+
+// Stretch the record at offset last of buf to the end of the block.
+void
+endblk(char *buf, int last)
+{
+  ((struct dirent*)(buf + last))->reclen = xshort(BSIZE - last);
+}
+
+// Write the n entries de (starting with "." and "..") as the
+// contents of directory inum: a single block if they fit,
+// else an indexed directory whose blocks are filled to
+// three quarters, leaving the kernel room to add names.
+void
+wdir(uint inum, struct rootent *de, int n)
+{
+  char root[BSIZE], buf[BSIZE];
+  struct dirent *rec;
+  struct dxhead *dh;
+  struct dxentry *e;
+  struct dinode din;
+  uint h;
+  int i, first, nblk, off, last, tot;
+
+  bzero(root, sizeof(root));
+  tot = 0;
+  for(i = 0; i < n; i++)
+    tot += DIRREC(strlen(de[i].name));
+  if(tot <= BSIZE){
+    for(i = off = last = 0; i < n; i++){
+      last = off;
+      off = putrec(root, off, de[i].inum, de[i].name);
+    }
+    endblk(root, last);
+    iappend(inum, root, BSIZE);
+    return;
+  }
+
+  // The first block goes out now and again once
+  // the index is complete.
+  off = putrec(root, 0, de[0].inum, de[0].name);
+  off = putrec(root, off, de[1].inum, de[1].name);
+  assert(off == DXREC);
+  rec = (struct dirent*)(root + DXREC);
+  rec->reclen = xshort(BSIZE - DXREC);
+  dh = (struct dxhead*)rec->name;
+  dh->magic = xint(DX_MAGIC);
+  e = (struct dxentry*)(dh + 1);
+  iappend(inum, root, BSIZE);
+
+  qsort(de + 2, n - 2, sizeof(*de), dxcmp);
+  nblk = 0;
+  for(i = 2; i < n; ){
+    // Never split a run of names with the same hash.
+    first = i;
+    h = dxhash(de[i].name);
+    bzero(buf, sizeof(buf));
+    off = last = 0;
+    while(i < n && (off < BSIZE*3/4 || dxhash(de[i].name) == h) &&
+          off + DIRREC(strlen(de[i].name)) <= BSIZE){
+      h = dxhash(de[i].name);
+      last = off;
+      off = putrec(buf, off, de[i].inum, de[i].name);
+      i++;
+    }
+    assert(i == n || i == first || dxhash(de[i].name) != h);
+    endblk(buf, last);
+    iappend(inum, buf, BSIZE);
+    assert(nblk < DXMAX);
+    e[nblk].hash = xint(nblk == 0 ? 0 : dxhash(de[first].name));
+    e[nblk].blk = xint(nblk + 1);
+    nblk++;
+  }
+  dh->count = xint(nblk);
+
+  rinode(inum, &din);
+  wsect(fbmap(&din, 0), root);
+}
@@ -0,0 +1,563 @@
+// Page cache and memory-mapped files.
+//
+// The page cache holds page-sized pieces of file contents,
+// each a kalloc()ed page, keyed by in-memory inode and page
+// number within the file.  mmap() maps those pages straight
+// into a process: a page is read from the file (through the
+// buffer cache) on the first fault, and later faults by any
+// process find it in the cache.
+//
+// A MAP_SHARED mapping maps the cached page itself, writable
+// if the mapping is, so that all processes see each other's
+// stores; the pages a process dirtied are written back to the
+// file when it unmaps them.  A MAP_PRIVATE mapping maps the
+// cached page read-only and copies it into a page of the
+// process's own when it first writes to it.  Only file data
+// is ever written back: a mapping never changes the size of
+// the file, and stores past the end of the file are lost.
+//
+// readi() and writei() go through a cached page when there is
+// one, so read() sees stores to shared mappings that are not
+// yet written back, and mappings see write()s at once.
+//
+// Pages of an inode are only added while the inode is locked,
+// by mmapfault(), and readi() and writei() look them up under
+// the same lock.  A page holds a reference for each mapping of
+// it; unreferenced pages stay cached on an LRU list and are
+// recycled least recently used first.  When that list is
+// empty the cache grows by another page of entries.  A page's
+// inode is kept in memory by the open files of the mappings,
+// and when the inode cache recycles an inode or its file is
+// deleted, pagedrop() forgets its pages.
+//
+// Interface:
+// * mmap() and munmap() add and remove mappings of the
+//   current process; mmapcopy() and munmapall() copy and
+//   drop all of them for fork(), exec() and exit().
+// * mmapfault() handles a page fault inside a mapping.
+// * mmapcheck() faults in a range the kernel is about to use.
+// * pageio() and pagedrop() are the file system's hooks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "stat.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "vdso.h"
+
+#if PGSIZE % BSIZE != 0
+#error "file blocks must not straddle pages"
+#endif
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NPHASH 61
+#define PPERPAGE (PGSIZE / sizeof(struct page))
+
+struct page {
+  struct inode *ip;     // File the page belongs to; 0 if unused
+  uint pgno;            // Page number within the file
+  int ref;              // Mappings, plus copies under way
+  char *data;           // Page contents, once allocated
+  struct page *hnext;   // hash chain
+  struct page *prev;    // LRU list, while ref is 0
+  struct page *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct page page[NPAGE];
+  struct page *hash[NPHASH];
+
+  // Linked list of unreferenced pages, through prev/next.
+  // head.next is most recently used.
+  struct page head;
+} pcache;
+
+static uint
+phash(struct inode *ip, uint pgno)
+{
+  return ((uint)ip / sizeof(*ip) + pgno) % NPHASH;
+}
+
+// Caller must hold pcache.lock.
+static void
+plruadd(struct page *p)
+{
+  p->next = pcache.head.next;
+  p->prev = &pcache.head;
+  pcache.head.next->prev = p;
+  pcache.head.next = p;
+}
+
+static void
+plruremove(struct page *p)
+{
+  p->next->prev = p->prev;
+  p->prev->next = p->next;
+}
+
+static void
+punhash(struct page *p)
+{
+  struct page **pp;
+
+  for(pp = &pcache.hash[phash(p->ip, p->pgno)]; *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+  p->ip->npage--;
+  p->ip = 0;
+}
+
+// Add a page of new, unused entries to the cache.
+// Caller must hold pcache.lock.
+static int
+pgrow(void)
+{
+  struct page *p;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  for(p = (struct page*)mem; p < (struct page*)mem + PPERPAGE; p++)
+    plruadd(p);
+  return 0;
+}
+
+void
+pageinit(void)
+{
+  struct page *p;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(p = pcache.page; p < pcache.page+NPAGE; p++)
+    plruadd(p);
+}
+
+// Find the cached page pgno of ip and take a reference to it.
+// Caller must hold pcache.lock.
+static struct page*
+plookup(struct inode *ip, uint pgno)
+{
+  struct page *p;
+
+  for(p = pcache.hash[phash(ip, pgno)]; p; p = p->hnext){
+    if(p->ip == ip && p->pgno == pgno){
+      if(p->ref++ == 0)
+        plruremove(p);
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Drop a reference to a page.
+static void
+pageput(struct page *p)
+{
+  acquire(&pcache.lock);
+  if(--p->ref == 0)
+    plruadd(p);
+  release(&pcache.lock);
+}
+
+// Return page pgno of the locked inode ip, with a reference,
+// reading it from the file if it is not cached.
+static struct page*
+pageget(struct inode *ip, uint pgno)
+{
+  struct page *p;
+  uint off;
+
+  acquire(&pcache.lock);
+  if((p = plookup(ip, pgno)) != 0){
+    release(&pcache.lock);
+    return p;
+  }
+
+  // Recycle the least recently used page.
+  if(pcache.head.prev == &pcache.head && pgrow() < 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  p = pcache.head.prev;
+  plruremove(p);
+  if(p->ip)
+    punhash(p);
+  p->ref = 1;
+  release(&pcache.lock);
+
+  if(p->data == 0 && (p->data = kalloc()) == 0){
+    pageput(p);
+    return 0;
+  }
+
+  // Not yet in the hash table, so readi() reads the file.
+  memset(p->data, 0, PGSIZE);
+  off = pgno * PGSIZE;
+  if(off < ip->size)
+    readi(ip, p->data, off, min(ip->size - off, PGSIZE));
+
+  acquire(&pcache.lock);
+  p->ip = ip;
+  p->pgno = pgno;
+  p->hnext = pcache.hash[phash(ip, pgno)];
+  pcache.hash[phash(ip, pgno)] = p;
+  ip->npage++;
+  release(&pcache.lock);
+  return p;
+}
+
+// Copy n bytes at offset off of the locked inode ip to or from
+// buf through its cached page, if there is one.  The bytes must
+// lie within one page.  Returns 1 if the page was cached.
+int
+pageio(struct inode *ip, char *buf, uint off, uint n, int write)
+{
+  struct page *p;
+
+  if(ip->npage == 0)
+    return 0;
+  acquire(&pcache.lock);
+  p = plookup(ip, off / PGSIZE);
+  release(&pcache.lock);
+  if(p == 0)
+    return 0;
+  if(write)
+    memmove(p->data + off%PGSIZE, buf, n);
+  else
+    memmove(buf, p->data + off%PGSIZE, n);
+  pageput(p);
+  return 1;
+}
+
+// Forget the cached pages of ip.  Pages still mapped keep
+// their contents but are no longer found through ip.
+void
+pagedrop(struct inode *ip)
+{
+  struct page *p, *next;
+  int h;
+
+  if(ip->npage == 0)
+    return;
+  acquire(&pcache.lock);
+  for(h = 0; h < NPHASH; h++){
+    for(p = pcache.hash[h]; p; p = next){
+      next = p->hnext;
+      if(p->ip != ip)
+        continue;
+      punhash(p);
+      if(p->ref == 0){
+        // Reuse it first.
+        plruremove(p);
+        p->next = &pcache.head;
+        p->prev = pcache.head.prev;
+        pcache.head.prev->next = p;
+        pcache.head.prev = p;
+      }
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Write the cached page at file offset off back to ip,
+// a few blocks per transaction as in filewrite().
+static void
+pagewrite(struct inode *ip, char *data, uint off)
+{
+  int maxblk = iwritemax();
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += maxblk*BSIZE){
+    begin_opn(iwriteblocks(maxblk));
+    ilock(ip);
+    if(off + i < ip->size){
+      n = min(ip->size - off - i, min(PGSIZE - i, maxblk*BSIZE));
+      writei(ip, data + i, off + i, n);
+    }
+    iunlock(ip);
+    end_opn(iwriteblocks(maxblk));
+  }
+}
+
+//PAGEBREAK!
+// Return the mapping of p that contains va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len > 0 && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Map len bytes of file f, from offset off on, into the
+// current process.  Returns the address of the mapping,
+// or -1.
+int
+mmap(struct file *f, uint len, int prot, int flags, uint off)
+{
+  struct vma *v, *w;
+  uint a;
+
+  if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  if(len == 0 || len > VDSO - MMAPBASE || off % PGSIZE != 0 || off + len < off)
+    return -1;
+  len = PGROUNDUP(len);
+
+  for(v = proc->vma; v < &proc->vma[NVMA] && v->len > 0; v++)
+    ;
+  if(v == &proc->vma[NVMA])
+    return -1;
+
+  // First fit above the heap.
+  a = MMAPBASE;
+  for(w = proc->vma; w < &proc->vma[NVMA]; ){
+    if(w->len > 0 && a < w->addr + w->len && w->addr < a + len){
+      a = w->addr + w->len;
+      w = proc->vma;
+    } else
+      w++;
+  }
+  if(a + len > VDSO)
+    return -1;
+
+  v->addr = a;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->off = off;
+  return a;
+}
+
+// Unmap the pages [a, a+len) of mapping v of p, writing back
+// the ones p dirtied in a shared mapping.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint a, uint len)
+{
+  struct page *pg;
+  pte_t *pte;
+  uint pa, end;
+
+  for(end = a + len; a < end; a += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    pa = PTE_ADDR(*pte);
+    if(v->flags == MAP_PRIVATE && (*pte & PTE_W)){
+      kfree(P2V(pa));
+    } else {
+      acquire(&pcache.lock);
+      pg = plookup(v->f->ip, (v->off + a - v->addr) / PGSIZE);
+      release(&pcache.lock);
+      if(pg == 0 || V2P(pg->data) != pa)
+        panic("vmaunmap");
+      if(v->flags == MAP_SHARED && (*pte & PTE_D))
+        pagewrite(v->f->ip, pg->data, pg->pgno * PGSIZE);
+      pageput(pg);  // the lookup's
+      pageput(pg);  // the mapping's
+    }
+    *pte = 0;
+  }
+  if(p == proc)
+    lcr3(V2P(p->pgdir));
+}
+
+// Remove the mappings of the current process in [addr, addr+len).
+// Only the start or the end of a mapping can be cut off.
+int
+munmap(uint addr, uint len)
+{
+  struct vma *v;
+  struct file *f;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmafind(proc, addr)) == 0 || addr + len > v->addr + v->len || addr + len < addr)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;
+
+  vmaunmap(proc, v, addr, len);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    f = v->f;
+    v->f = 0;
+    fileclose(f);
+  }
+  return 0;
+}
+
+// Remove all mappings of p.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->addr, v->len);
+    v->len = 0;
+    fileclose(v->f);
+    v->f = 0;
+  }
+}
+
+// Give np copies of the mappings of p, sharing the cached
+// pages and copying the private ones.
+int
+mmapcopy(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv;
+  struct page *pg;
+  pte_t *pte, *npte;
+  uint a;
+  char *mem;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    filedup(nv->f);
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+        continue;
+      if((npte = walkpgdir(np->pgdir, (char*)a, 1)) == 0)
+        goto bad;
+      if(v->flags == MAP_PRIVATE && (*pte & PTE_W)){
+        if((mem = kalloc()) == 0)
+          goto bad;
+        memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+        *npte = V2P(mem) | PTE_FLAGS(*pte);
+      } else {
+        acquire(&pcache.lock);
+        pg = plookup(v->f->ip, (v->off + a - v->addr) / PGSIZE);
+        release(&pcache.lock);
+        if(pg == 0)
+          panic("mmapcopy");
+        // Only the process that dirtied it writes it back.
+        *npte = *pte & ~PTE_D;
+      }
+    }
+  }
+  return 0;
+
+bad:
+  munmapall(np);
+  return -1;
+}
+
+// Handle a fault at va in the current process, for a write
+// if write is set.  Returns 0 if va lies in a mapping that
+// allows the access and the page is now mapped, else -1.
+int
+mmapfault(uint va, int write)
+{
+  struct vma *v;
+  struct page *pg;
+  struct inode *ip;
+  pte_t *pte;
+  uint a, off;
+  char *mem;
+
+  if((v = vmafind(proc, va)) == 0)
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  a = PGROUNDDOWN(va);
+  off = v->off + a - v->addr;
+  ip = v->f->ip;
+  if((pte = walkpgdir(proc->pgdir, (char*)a, 1)) == 0)
+    return -1;
+
+  if(*pte & PTE_P){
+    // Write to a private page still shared with the cache.
+    if(!write || v->flags != MAP_PRIVATE || (*pte & PTE_W))
+      return -1;
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+    acquire(&pcache.lock);
+    pg = plookup(ip, off / PGSIZE);
+    release(&pcache.lock);
+    if(pg == 0)
+      panic("mmapfault");
+    pageput(pg);
+    pageput(pg);
+    *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+    lcr3(V2P(proc->pgdir));
+    return 0;
+  }
+
+  ilock(ip);
+  if(off >= ip->size){
+    iunlock(ip);
+    return -1;
+  }
+  pg = pageget(ip, off / PGSIZE);
+  iunlock(ip);
+  if(pg == 0)
+    return -1;
+
+  if(write && v->flags == MAP_PRIVATE){
+    if((mem = kalloc()) == 0){
+      pageput(pg);
+      return -1;
+    }
+    memmove(mem, pg->data, PGSIZE);
+    pageput(pg);
+    *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+  } else if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE)){
+    *pte = V2P(pg->data) | PTE_P | PTE_W | PTE_U;
+  } else {
+    *pte = V2P(pg->data) | PTE_P | PTE_U;
+  }
+  return 0;
+}
+
+// Check that the n bytes at addr lie in mappings of the
+// current process that allow the kernel to read them, or
+// also to write them if write is set, and fault them in,
+// so that the kernel can use them without taking a fault.
+int
+mmapcheck(uint addr, uint n, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  if(addr + n < addr)
+    return -1;
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE){
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (!write || (*pte & PTE_W)))
+      continue;
+    if(mmapfault(a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
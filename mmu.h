@@ -39,12 +39,21 @@
 
 #define CR4_PSE         0x00000010      // Page size extension
 
-// various segment selectors.
+// Model-specific registers for sysenter.
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// cpuid 1 %edx feature flags
+#define CPUID_SEP       0x00000800      // sysenter and sysexit
+
+// various segment selectors.  sysenter and sysexit find the
+// kernel stack and the user segments right after SEG_KCODE.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
-#define SEG_KCPU  3  // kernel per-cpu data
-#define SEG_UCODE 4  // user code
-#define SEG_UDATA 5  // user data+stack
+#define SEG_UCODE 3  // user code
+#define SEG_UDATA 4  // user data+stack
+#define SEG_KCPU  5  // kernel per-cpu data
 #define SEG_TSS   6  // this process's task state
 
 // cpu->gdt[NSEGS] holds the above segments.
@@ -3,13 +3,20 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // initial size of the inode cache
+#define NDENTRY     128  // size of directory entry cache
+#define NPAGE        64  // initial size of the page cache
+#define NVMA         16  // memory-mapped files per process
 #define NDEV         10  // maximum major device number
+#define HZ          100  // clock ticks per second, at least 19
+#define NSTICK      (1000000000/HZ)  // nanoseconds per tick
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*3)  // min size of on-disk log (mkfs)
+#define MAXLOGSIZE   (MAXOPBLOCKS*6)  // max data blocks the kernel logs
+#define NBUF         (MAXLOGSIZE*2+MAXOPBLOCKS)  // size of disk block cache
+#define FSSIZE       20000  // size of file system in blocks
+#define FLUSHTICKS   300  // ticks between commits of the log
 #define QUANTA       2    //cpu time slice
 
@@ -0,0 +1,90 @@
+// PCI configuration space, through configuration mechanism #1
+// (I/O ports 0xCF8/0xCFC).  Just enough for the disk drivers
+// to find their controllers on bus 0, as QEMU lays them out,
+// and to read their base address registers.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_CONFADDR  0xCF8
+#define PCI_CONFDATA  0xCFC
+
+#define PCI_ID        0x00  // vendor (low 16 bits) and device id
+#define PCI_CMD       0x04  // command (low 16 bits) and status
+#define PCI_CLASS     0x08  // class, subclass, interface, revision
+#define PCI_HEADER    0x0C  // header type in bits 16-23
+
+#define PCI_CMD_IO    0x01  // respond to I/O space accesses
+#define PCI_CMD_MEM   0x02  // respond to memory space accesses
+#define PCI_CMD_BM    0x04  // may act as bus master (DMA)
+
+// A device is named by a tag: (bus<<16) | (dev<<11) | (func<<8).
+#define PCITAG(bus, dev, func) (((bus)<<16) | ((dev)<<11) | ((func)<<8))
+
+uint
+pciconfread(uint tag, int off)
+{
+  outl(PCI_CONFADDR, 0x80000000 | tag | (off & 0xfc));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciconfwrite(uint tag, int off, uint v)
+{
+  outl(PCI_CONFADDR, 0x80000000 | tag | (off & 0xfc));
+  outl(PCI_CONFDATA, v);
+}
+
+// Scan bus 0 for the first function whose id matches
+// vendor/device, or (if vendor is 0) whose class and
+// subclass match class/subclass.
+// Store its tag in *ptag and return 0, or return -1.
+static int
+pcifind(int vendor, int device, int class, int subclass, uint *ptag)
+{
+  int dev, func, nfunc;
+  uint tag, id, cls;
+
+  for(dev = 0; dev < 32; dev++){
+    nfunc = 1;
+    for(func = 0; func < nfunc; func++){
+      tag = PCITAG(0, dev, func);
+      id = pciconfread(tag, PCI_ID);
+      if((id & 0xffff) == 0xffff)
+        continue;
+      if(func == 0 && (pciconfread(tag, PCI_HEADER) & 0x800000))
+        nfunc = 8;  // multi-function device
+      cls = pciconfread(tag, PCI_CLASS);
+      if(vendor ? ((id & 0xffff) == vendor && (id >> 16) == device)
+                : ((cls >> 24) == class && ((cls >> 16) & 0xff) == subclass)){
+        *ptag = tag;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+int
+pcifinddev(int vendor, int device, uint *ptag)
+{
+  return pcifind(vendor, device, 0, 0, ptag);
+}
+
+int
+pcifindclass(int class, int subclass, uint *ptag)
+{
+  return pcifind(0, 0, class, subclass, ptag);
+}
+
+// Let the function decode its I/O and memory BARs and
+// master the bus, so that it can DMA into memory.
+void
+pcienable(uint tag)
+{
+  uint cmd;
+
+  cmd = pciconfread(tag, PCI_CMD);
+  pciconfwrite(tag, PCI_CMD, cmd | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_BM);
+}
@@ -1,24 +1,59 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of pages, PIPESIZE bytes unless
+// pipesize() has changed it.  The size is always a power of two,
+// so the ring position nread or nwrite % size survives wrap-around.
+//
+// A write of a page or more can skip the ring: the writer lends
+// its own pages, and readers copy straight out of them.
+#define PIPESIZE PGSIZE
+#define PIPEMAX  (16*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEMAX/PGSIZE];  // buffer pages
+  uint size;      // buffer size in bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct waitq rwait;  // readers waiting for data
+  struct waitq wwait;  // writers waiting for room
+  struct proc *dproc;  // writer lending its pages, or 0
+  uint daddr;     // next byte to read, in dproc's memory
+  uint dlen;      // bytes left to read there
+  struct pollq pq;  // poll() and epoll waiters
 };
 
+// Address of stream byte pos in the ring.
+static char*
+pipeaddr(struct pipe *p, uint pos)
+{
+  pos %= p->size;
+  return p->data[pos / PGSIZE] + pos % PGSIZE;
+}
+
+// Bytes that can be moved at once from stream byte pos,
+// at most max: a page boundary breaks the ring's storage.
+static int
+pipespan(uint pos, uint max)
+{
+  uint n;
+
+  n = PGSIZE - pos % PGSIZE;
+  return n < max ? n : max;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,16 +65,20 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  if((p->data[0] = kalloc()) == 0)
+    goto bad;
+  p->size = PIPESIZE;
   p->readopen = 1;
   p->writeopen = 1;
-  p->nwrite = 0;
-  p->nread = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
+  (*f0)->flags = 0;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
   (*f0)->pipe = p;
   (*f1)->type = FD_PIPE;
+  (*f1)->flags = 0;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
   (*f1)->pipe = p;
@@ -59,63 +98,248 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *p, int writable)
 {
+  int i;
+
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
-    wakeup(&p->nread);
+    wqwakeup(&p->rwait);
   } else {
     p->readopen = 0;
-    wakeup(&p->nwrite);
+    wqwakeup(&p->wwait);
   }
+  pollwake(&p->pq, POLLHUP);
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    for(i = 0; i < p->size / PGSIZE; i++)
+      kfree(p->data[i]);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Resize p's buffer to hold at least n bytes, if n > 0.
+// Fails if n is more than PIPEMAX or less than the bytes
+// already in the pipe.  Returns the buffer size.
+int
+pipesize(struct pipe *p, int n)
+{
+  char *data[PIPEMAX/PGSIZE], *old[PIPEMAX/PGSIZE];
+  uint size, oldsize, pos;
+  int i, m;
+
+  if(n <= 0)
+    return p->size;
+  if(n > PIPEMAX)
+    return -1;
+  for(size = PGSIZE; size < n; size *= 2)
+    ;
+
+  // Allocate the new ring before taking the lock.
+  memset(data, 0, sizeof(data));
+  for(i = 0; i < size / PGSIZE; i++){
+    if((data[i] = kalloc()) == 0)
+      goto bad;
+  }
+
+  acquire(&p->lock);
+  if(p->nwrite - p->nread > size){
+    release(&p->lock);
+    goto bad;
+  }
+  // Both rings are whole pages, so a span that doesn't
+  // cross a page in one doesn't in the other.
+  for(pos = p->nread; pos != p->nwrite; pos += m){
+    m = pipespan(pos, p->nwrite - pos);
+    memmove(data[pos % size / PGSIZE] + pos % PGSIZE, pipeaddr(p, pos), m);
+  }
+  oldsize = p->size;
+  memmove(old, p->data, sizeof(old));
+  memmove(p->data, data, sizeof(data));
+  p->size = size;
+  wqwakeup(&p->wwait);
+  pollwake(&p->pq, POLLOUT);
+  release(&p->lock);
+
+  for(i = 0; i < oldsize / PGSIZE; i++)
+    kfree(old[i]);
+  return size;
+
+ bad:
+  for(i = 0; i < size / PGSIZE && data[i]; i++)
+    kfree(data[i]);
+  return -1;
+}
+
+// Writers sleep here, waking any sleeping reader first.
+// Returns -1, with p->lock released, if the write
+// should give up instead.
+static int
+pipewwait(struct pipe *p)
+{
+  if(p->readopen == 0 || proc->killed){
+    release(&p->lock);
+    return -1;
+  }
+  wqwakeup(&p->rwait);
+  pollwake(&p->pq, POLLIN);
+  wqsleep(&p->wwait, &p->lock);  //DOC: pipewrite-sleep
+  return 0;
+}
+
+// Should the n bytes at addr be lent rather than copied?
+// Only a write of a page or more, and only if a reader is
+// waiting or the ring has no room for it: a write that fits
+// must not wait for a reader.  User pages must be present;
+// sendfile() lends the kernel buffer it writes from.
+static int
+pipecanlend(struct pipe *p, char *addr, int n)
+{
+  uint a;
+
+  if(n < PGSIZE)
+    return 0;
+  if(p->rwait.head == 0 && n <= p->nread + p->size - p->nwrite)
+    return 0;
+  if((uint)addr >= KERNBASE)
+    return 1;
+  for(a = PGROUNDDOWN((uint)addr); a < (uint)addr + n; a += PGSIZE)
+    if(uva2ka(proc->pgdir, (char*)a) == 0)
+      return 0;
+  return 1;
+}
+
+// Kernel address of the next byte a lending writer offers.
+static char*
+pipelent(struct pipe *p)
+{
+  char *page;
+
+  if(p->daddr >= KERNBASE)
+    return (char*)p->daddr;
+  page = uva2ka(p->dproc->pgdir, (char*)PGROUNDDOWN(p->daddr));
+  return page + p->daddr % PGSIZE;
+}
+
+// Write n bytes by lending the pages at addr: once the ring
+// has drained, readers copy from them directly, and the writer
+// sleeps until they are done.  The pages can't go away in the
+// meantime, since only their owner, asleep here, can unmap them.
+static int
+pipelend(struct pipe *p, char *addr, int n)
+{
+  while(p->dproc || p->nwrite != p->nread)
+    if(pipewwait(p) < 0)
+      return -1;
+  p->dproc = proc;
+  p->daddr = (uint)addr;
+  p->dlen = n;
+  while(p->dproc == proc){
+    if(p->readopen == 0 || proc->killed)
+      p->dproc = 0;  // take the pages back; pipewwait gives up
+    if(pipewwait(p) < 0)
+      return -1;
+  }
+  release(&p->lock);
+  return n;
+}
+
 //PAGEBREAK: 40
+// Write n bytes from addr to p.  If nonblock, write only
+// what fits without waiting, and fail if that is nothing.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || proc->killed){
+  if(!nonblock && pipecanlend(p, addr, n))
+    return pipelend(p, addr, n);
+  for(i = 0; i < n; i += m){
+    while(p->dproc || p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
+      if(nonblock){
+        if(i > 0)
+          goto out;
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      if(pipewwait(p) < 0)
+        return -1;
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = pipespan(p->nwrite, p->nread + p->size - p->nwrite);
+    if(m > n - i)
+      m = n - i;
+    memmove(pipeaddr(p, p->nwrite), addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+ out:
+  wqwakeup(&p->rwait);  //DOC: pipewrite-wakeup1
+  pollwake(&p->pq, POLLIN);
   release(&p->lock);
-  return n;
+  return i;
 }
 
+// Read up to n bytes from p into addr.  If nonblock,
+// fail rather than wait for a writer.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(proc->killed){
+  while(p->nread == p->nwrite && p->dproc == 0 && p->writeopen){  //DOC: pipe-empty
+    if(nonblock || proc->killed){
       release(&p->lock);
       return -1;
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    wqsleep(&p->rwait, &p->lock); //DOC: piperead-sleep
+  }
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = pipespan(p->nread, p->nwrite - p->nread);
+    if(m > n - i)
+      m = n - i;
+    memmove(addr + i, pipeaddr(p, p->nread), m);
+    p->nread += m;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  // The ring is empty whenever a writer is lending pages.
+  for(; i < n && p->dproc; i += m){
+    m = pipespan(p->daddr, p->dlen);
+    if(m > n - i)
+      m = n - i;
+    memmove(addr + i, pipelent(p), m);
+    p->daddr += m;
+    p->dlen -= m;
+    if(p->dlen == 0)
+      p->dproc = 0;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  wqwakeup(&p->wwait);  //DOC: piperead-wakeup
+  pollwake(&p->pq, POLLOUT);
   release(&p->lock);
   return i;
 }
+
+// Report POLLIN or POLLOUT, and POLLHUP, for the read or write
+// end of p, and have e woken when they may change.
+int
+pipepoll(struct pipe *p, int writable, struct pollent *e)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writable){
+    if(p->dproc == 0 && p->nwrite != p->nread + p->size)
+      r |= POLLOUT;
+    if(p->readopen == 0)
+      r |= POLLHUP;
+  } else {
+    if(p->nread != p->nwrite || p->dproc)
+      r |= POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLHUP;
+  }
+  if(e)
+    pollrecord(&p->pq, e);
+  release(&p->lock);
+  return r;
+}
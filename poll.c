@@ -0,0 +1,358 @@
+//
+// Waiting on several files at once: poll() and epoll sets.
+//
+// Pipes and the console keep a pollq of pollents.  Checking a
+// file with filepoll() can put an entry on the object's queue,
+// and the object calls pollwake() whenever it may have become
+// ready.  poll() keeps one entry per descriptor on its kernel
+// stack for the length of the call.  An epoll set keeps an
+// entry for each file it watches; pollwake() moves those to
+// the set's ready list, so epoll_wait() only looks at files
+// that have changed, not at every file in the set.
+//
+// polllock protects the queues and ready lists.  pollrecord()
+// and pollwake() are called with the object's lock held, so a
+// check of the object can't miss a wakeup.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+#include "callout.h"
+
+#define NEPOLL NOFILE  // files in one epoll set
+
+struct epoll {
+  struct spinlock lock;   // protects ent[] against epollctl()
+  struct pollwaiter w;
+  struct pollent ent[NEPOLL];
+};
+
+static struct spinlock polllock;
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Have e woken by pollwake(q).  Caller holds the lock of the
+// object that owns q.
+void
+pollrecord(struct pollq *q, struct pollent *e)
+{
+  acquire(&polllock);
+  if(e->q == 0){
+    e->q = q;
+    e->next = q->head;
+    q->head = e;
+  }
+  release(&polllock);
+}
+
+// Put epoll entry e on its set's ready list.
+// Caller holds polllock.
+static void
+pollready(struct pollent *e)
+{
+  if(!e->ready){
+    e->ready = 1;
+    e->rnext = e->w->ready;
+    e->w->ready = e;
+  }
+}
+
+// Take e off its queue and ready list.
+static void
+pollforget(struct pollent *e)
+{
+  struct pollent **pp;
+
+  acquire(&polllock);
+  if(e->q){
+    for(pp = &e->q->head; *pp != e; pp = &(*pp)->next)
+      ;
+    *pp = e->next;
+    e->q = 0;
+  }
+  if(e->ready){
+    for(pp = &e->w->ready; *pp != e; pp = &(*pp)->rnext)
+      ;
+    *pp = e->rnext;
+    e->ready = 0;
+  }
+  release(&polllock);
+}
+
+// The object owning q may now have some of events (and
+// POLLHUP always counts); wake the waiters interested.
+// Caller holds the object's lock.
+void
+pollwake(struct pollq *q, int events)
+{
+  struct pollent *e;
+
+  if(q->head == 0)
+    return;
+  acquire(&polllock);
+  for(e = q->head; e; e = e->next){
+    if((e->events & events) == 0 && (events & POLLHUP) == 0)
+      continue;
+    if(e->f)
+      pollready(e);
+    e->w->woken = 1;
+    wqwakeup(&e->w->wq);
+  }
+  release(&polllock);
+}
+
+// A poll timeout: wake the waiter as pollwake() would.
+static void
+pollexpire(struct callout *c)
+{
+  struct pollwaiter *w;
+
+  w = c->arg;
+  acquire(&polllock);
+  w->woken = 1;
+  wqwakeup(&w->wq);
+  release(&polllock);
+}
+
+// Sleep until w is woken, or, if timed, until ticks reaches end.
+// Returns -1 if the process has been killed.
+static int
+pollsleep(struct pollwaiter *w, int timed, uint end)
+{
+  struct callout c;
+
+  c.pending = 0;
+  if(timed){
+    acquire(&tickslock);
+    calloutadd(&c, end, pollexpire, w);
+    release(&tickslock);
+  }
+  acquire(&polllock);
+  while(!w->woken && !proc->killed)
+    wqsleep(&w->wq, &polllock);
+  release(&polllock);
+  if(timed){
+    acquire(&tickslock);
+    calloutdel(&c);
+    release(&tickslock);
+  }
+  return proc->killed ? -1 : 0;
+}
+
+// Has a timeout that ends at tick end expired?
+static int
+polltimedout(int timeout, uint end)
+{
+  return timeout == 0 || (timeout > 0 && (int)(end - ticks) <= 0);
+}
+
+// Wait until one of the n descriptors in fds is ready, or
+// timeout ticks go by.  Returns the number of ready descriptors.
+int
+poll(struct pollfd *fds, int n, int timeout)
+{
+  struct pollent ent[NOFILE];
+  struct pollwaiter w;
+  struct file *f;
+  int i, nready;
+  uint end;
+
+  if(n < 0 || n > NOFILE)
+    return -1;
+  memset(ent, 0, sizeof(ent));
+  memset(&w, 0, sizeof(w));
+  end = ticks + timeout;
+  for(;;){
+    acquire(&polllock);
+    w.woken = 0;
+    release(&polllock);
+
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= NOFILE || (f = proc->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else {
+        ent[i].events = fds[i].events;
+        ent[i].w = &w;
+        fds[i].revents = filepoll(f, &ent[i]) & (fds[i].events | POLLHUP);
+      }
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready > 0 || polltimedout(timeout, end))
+      break;
+    if(pollsleep(&w, timeout > 0, end) < 0){
+      nready = -1;
+      break;
+    }
+  }
+
+  for(i = 0; i < n; i++)
+    pollforget(&ent[i]);
+  return nready;
+}
+
+// Allocate an empty epoll set.
+struct epoll*
+epollalloc(void)
+{
+  struct epoll *ep;
+  int i;
+
+  if((ep = (struct epoll*)kalloc()) == 0)
+    return 0;
+  memset(ep, 0, sizeof(*ep));
+  initlock(&ep->lock, "epoll");
+  for(i = 0; i < NEPOLL; i++)
+    ep->ent[i].w = &ep->w;
+  return ep;
+}
+
+// Free ep, which is no longer in use, and let go of its files.
+void
+epollclose(struct epoll *ep)
+{
+  int i;
+
+  for(i = 0; i < NEPOLL; i++){
+    if(ep->ent[i].f){
+      pollforget(&ep->ent[i]);
+      fileclose(ep->ent[i].f);
+    }
+  }
+  kfree((char*)ep);
+}
+
+// Add f to ep, remove it, or change the events to watch for.
+// The set holds a reference to each file it watches.
+int
+epollctl(struct epoll *ep, int op, struct file *f, struct epoll_event *ev)
+{
+  struct pollent *e, *free;
+  struct file *old;
+
+  if(f->type == FD_EPOLL)
+    return -1;
+  acquire(&ep->lock);
+  free = 0;
+  for(e = ep->ent; e < &ep->ent[NEPOLL]; e++){
+    if(e->f == f)
+      break;
+    if(e->f == 0 && free == 0)
+      free = e;
+  }
+  if(e == &ep->ent[NEPOLL])
+    e = 0;
+
+  old = 0;
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(e || (e = free) == 0)
+      goto bad;
+    e->f = filedup(f);
+    break;
+  case EPOLL_CTL_DEL:
+    if(e == 0)
+      goto bad;
+    pollforget(e);
+    old = e->f;
+    e->f = 0;
+    release(&ep->lock);
+    fileclose(old);
+    return 0;
+  case EPOLL_CTL_MOD:
+    if(e == 0)
+      goto bad;
+    break;
+  default:
+    goto bad;
+  }
+
+  acquire(&polllock);
+  e->events = ev->events;
+  e->data = ev->data;
+  release(&polllock);
+  if(filepoll(f, e) & (ev->events | POLLHUP)){
+    acquire(&polllock);
+    pollready(e);
+    release(&polllock);
+  }
+  release(&ep->lock);
+  return 0;
+
+ bad:
+  release(&ep->lock);
+  return -1;
+}
+
+// Wait until some file in ep is ready, or timeout ticks go by,
+// and report at most n of them in evs.  Only files on the ready
+// list are checked; those still ready stay on it for next time.
+int
+epollwait(struct epoll *ep, struct epoll_event *evs, int n, int timeout)
+{
+  struct pollent *rl[NEPOLL], *e;
+  int i, nr, nready, r;
+  uint end;
+
+  if(n <= 0)
+    return -1;
+  end = ticks + timeout;
+  for(;;){
+    acquire(&ep->lock);
+    acquire(&polllock);
+    ep->w.woken = 0;
+    nr = 0;
+    for(e = ep->w.ready; e; e = e->rnext){
+      e->ready = 0;
+      rl[nr++] = e;
+    }
+    ep->w.ready = 0;
+    release(&polllock);
+
+    nready = 0;
+    for(i = 0; i < nr; i++){
+      e = rl[i];
+      r = filepoll(e->f, 0) & (e->events | POLLHUP);
+      if(r == 0)
+        continue;
+      if(nready < n){
+        evs[nready].events = r;
+        evs[nready].data = e->data;
+        nready++;
+      }
+      acquire(&polllock);
+      pollready(e);
+      release(&polllock);
+    }
+    release(&ep->lock);
+
+    if(nready > 0 || polltimedout(timeout, end))
+      return nready;
+    if(pollsleep(&ep->w, timeout > 0, end) < 0)
+      return -1;
+  }
+}
+
+// Is some file in ep possibly ready?  An epoll set can be
+// checked, but not waited on, by poll().
+int
+epollpoll(struct epoll *ep)
+{
+  return ep->w.ready ? POLLIN : 0;
+}
@@ -0,0 +1,22 @@
+// poll() and epoll sets.  Timeouts are in clock ticks, as
+// for sleep(): 0 means don't wait, negative means forever.
+
+struct pollfd {
+  int fd;           // descriptor to check, ignored if negative
+  short events;     // conditions of interest
+  short revents;    // conditions that hold
+};
+
+#define POLLIN    0x001  // read won't block
+#define POLLOUT   0x004  // write won't block
+#define POLLHUP   0x010  // other end of a pipe closed
+#define POLLNVAL  0x020  // fd not open
+
+struct epoll_event {
+  int events;       // POLLIN, POLLOUT; POLLHUP is always reported
+  int data;         // caller's, returned with the event
+};
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
@@ -6,9 +6,17 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
-
+#include "sleeplock.h"
+
+// A slot's pid and name, and the state changes that hand it
+// out and take it back (from UNUSED to EMBRYO, to ZOMBIE, and
+// back to UNUSED), happen only under the lock and inside seq's
+// write brackets, so procdump() can read them without the lock.
+// The scheduler's changes among RUNNABLE, RUNNING and SLEEPING
+// are not bracketed.
 struct {
   struct spinlock lock;
+  struct seqcount seq;
   struct proc proc[NPROC];
 } ptable;
 
@@ -20,12 +28,34 @@ extern void trapret(void);
 
 static void wakeup1(void *chan);
 
+// sleep() and wakeup() on an arbitrary channel use one of these
+// queues, chosen by hashing the channel, so that a wakeup looks
+// only at processes that slept on a channel with the same hash.
+#define NCHANQ 31
+static struct waitq chanq[NCHANQ];
+
+#define CHANQ(chan) (&chanq[((uint)(chan) >> 2) % NCHANQ])
+
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
 }
 
+// Give back p, which allocproc() handed out but which
+// never ran.
+static void
+unallocproc(struct proc *p)
+{
+  acquire(&ptable.lock);
+  seqwbegin(&ptable.seq);
+  p->pid = 0;
+  p->name[0] = 0;
+  p->state = UNUSED;
+  seqwend(&ptable.seq);
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -47,8 +77,11 @@ allocproc(void)
   return 0;
 
 found:
+  seqwbegin(&ptable.seq);
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->name[0] = 0;
+  seqwend(&ptable.seq);
   p->ctime = ticks;
   p->rtime = 0;
   p->etime = 0;
@@ -59,7 +92,7 @@ found:
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    unallocproc(p);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -95,6 +128,8 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  if(vdsomap(p->pgdir, p->pid) < 0)
+    panic("userinit: out of memory?");
   p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -105,7 +140,7 @@ userinit(void)
   p->tf->esp = PGSIZE;
   p->tf->eip = 0;  // beginning of initcode.S
 
-  safestrcpy(p->name, "initcode", sizeof(p->name));
+  setprocname(p, "initcode");
   p->cwd = namei("/");
 
   // this assignment to p->state lets other cores
@@ -119,6 +154,41 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread running fn(), which must not return.
+// It has no user memory; forkret() "returns" into fn()
+// instead of trapret.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread: no proc");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory?");
+  *(uint*)(p->context + 1) = (uint)fn;
+  setprocname(p, name);
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
+// Set p's name, as procdump() shows it.
+void
+setprocname(struct proc *p, char *name)
+{
+  char buf[sizeof(p->name)];
+
+  // name may be in user memory; don't touch it with the lock held.
+  safestrcpy(buf, name, sizeof(buf));
+  acquire(&ptable.lock);
+  seqwbegin(&ptable.seq);
+  memmove(p->name, buf, sizeof(buf));
+  seqwend(&ptable.seq);
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -128,6 +198,8 @@ growproc(int n)
 
   sz = proc->sz;
   if(n > 0){
+    if(sz + n > MMAPBASE || sz + n < sz)
+      return -1;
     if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -157,7 +229,15 @@ fork(void)
   if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    unallocproc(np);
+    return -1;
+  }
+  if(mmapcopy(np, proc) < 0 || vdsomap(np->pgdir, np->pid) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    unallocproc(np);
     return -1;
   }
   np->sz = proc->sz;
@@ -173,7 +253,7 @@ fork(void)
       np->ofile[i] = filedup(proc->ofile[i]);
   np->cwd = idup(proc->cwd);
 
-  safestrcpy(np->name, proc->name, sizeof(proc->name));
+  setprocname(np, proc->name);
 
   pid = np->pid;
 
@@ -198,6 +278,9 @@ exit(void)
   if(proc == initproc)
     panic("init exiting");
 
+  // Unmap files, writing back what was stored to them.
+  munmapall(proc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(proc->ofile[fd]){
@@ -226,7 +309,9 @@ exit(void)
   }
 
   // Jump into the scheduler, never to return.
+  seqwbegin(&ptable.seq);
   proc->state = ZOMBIE;
+  seqwend(&ptable.seq);
   proc->etime = ticks;
   sched();
   panic("zombie exit");
@@ -254,11 +339,13 @@ wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
+        seqwbegin(&ptable.seq);
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
+        seqwend(&ptable.seq);
         p->flag = 0;
         release(&ptable.lock);
         return pid;
@@ -547,16 +634,19 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    kthread(logflush, "logflush");
   }
 
   // Return to "caller", actually trapret (see allocproc).
 }
 
-// Atomically release lock and sleep on chan.
+// Atomically release lock and sleep on chan, on queue q.
 // Reacquires lock when awakened.
-void
-sleep(void *chan, struct spinlock *lk)
+static void
+sleep1(struct waitq *q, void *chan, struct spinlock *lk)
 {
+  struct proc **pp;
+
   if(proc == 0)
     panic("sleep");
 
@@ -568,18 +658,30 @@ sleep(void *chan, struct spinlock *lk)
   // Once we hold ptable.lock, we can be
   // guaranteed that we won't miss any wakeup
   // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
+  // so it's okay to release lk.  Join q first,
+  // though: wqwakeup() looks at an empty q
+  // without ptable.lock.
+  if(lk != &ptable.lock)  //DOC: sleeplock0
     acquire(&ptable.lock);  //DOC: sleeplock1
+  proc->chan = chan;
+  proc->wq = q;
+  proc->wqnext = q->head;
+  q->head = proc;
+  proc->state = SLEEPING;
+  if(lk != &ptable.lock)
     release(lk);
-  }
 
   // Go to sleep.
-  proc->chan = chan;
-  proc->state = SLEEPING;
   sched();
 
-  // Tidy up.
+  // Tidy up.  kill() wakes a process without
+  // taking it off its queue.
+  if(proc->wq){
+    for(pp = &proc->wq->head; *pp != proc; pp = &(*pp)->wqnext)
+      ;
+    *pp = proc->wqnext;
+    proc->wq = 0;
+  }
   proc->chan = 0;
 
   // Reacquire original lock.
@@ -589,17 +691,39 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
+// Wake the processes on q sleeping on chan.
+// The ptable lock must be held.
+static void
+wakeq(struct waitq *q, void *chan)
+{
+  struct proc **pp, *p;
+
+  for(pp = &q->head; (p = *pp) != 0; ){
+    if(p->chan == chan){
+      *pp = p->wqnext;
+      p->wq = 0;
+      if(p->state == SLEEPING)
+        p->state = RUNNABLE;
+    } else
+      pp = &p->wqnext;
+  }
+}
+
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleep1(CHANQ(chan), chan, lk);
+}
+
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  wakeq(CHANQ(chan), chan);
 }
 
 // Wake up all processes sleeping on chan.
@@ -611,6 +735,27 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Atomically release lock and sleep on q.
+// Reacquires lock when awakened.
+void
+wqsleep(struct waitq *q, struct spinlock *lk)
+{
+  sleep1(q, q, lk);
+}
+
+// Wake up all processes sleeping on q.  The caller
+// holds the lock the sleepers passed to wqsleep(),
+// so none can be on its way onto q.
+void
+wqwakeup(struct waitq *q)
+{
+  if(q->head == 0)
+    return;
+  acquire(&ptable.lock);
+  wakeq(q, q);
+  release(&ptable.lock);
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -619,25 +764,36 @@ kill(int pid)
 {
   struct proc *p;
 
+  // Look for pid without the lock.  A process keeps its slot
+  // for life and pids are not reused, so the scan can't miss
+  // it; the lock is needed only to check that it hasn't been
+  // reaped meanwhile, and to wake it.
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pid == pid)
+      break;
+  if(p == &ptable.proc[NPROC])
+    return -1;
+
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if(p->pid != pid){
+    release(&ptable.lock);
+    return -1;
   }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING)
+    p->state = RUNNABLE;
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// No lock to avoid wedging a stuck machine further;
+// ptable.seq gives a pid, name and state that go together,
+// though whether a live process is runnable, running or
+// sleeping may be a moment out of date.
 void
 procdump(void)
 {
@@ -649,20 +805,31 @@ procdump(void)
   [RUNNING]   "run   ",
   [ZOMBIE]    "zombie"
   };
-  int i;
+  int i, pid;
   struct proc *p;
-  char *state;
-  uint pc[10];
+  struct sleeplock *lk;
+  enum procstate st;
+  char *state, name[sizeof(p->name)];
+  uint pc[10], t;
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
+    do {
+      t = seqbegin(&ptable.seq);
+      pid = p->pid;
+      st = p->state;
+      memmove(name, p->name, sizeof(name));
+    } while(seqretry(&ptable.seq, t));
+    name[sizeof(name)-1] = 0;
+    if(st == UNUSED)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
+    if(st >= 0 && st < NELEM(states) && states[st])
+      state = states[st];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
-    if(p->state == SLEEPING){
+    cprintf("%d %s %s", pid, state, name);
+    if(st == SLEEPING && (lk = p->waitlock) != 0)
+      cprintf(" [%s held by %d]", lk->name, lk->pid);
+    if(st == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
         cprintf(" %p", pc[i]);
@@ -690,11 +857,13 @@ int gettime(int *ctime, int *rtime, int *etime) {
             kfree(p->kstack);
             p->kstack = 0;
             freevm(p->pgdir);
+            seqwbegin(&ptable.seq);
             p->state = UNUSED;
             p->pid = 0;
             p->parent = 0;
             p->name[0] = 0;
             p->killed = 0;
+            seqwend(&ptable.seq);
             p->ctime = 0;
             p->etime = 0;
             p->rtime = 0;
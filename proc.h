@@ -3,6 +3,7 @@ struct cpu {
   uchar apicid;                // Local APIC ID
   struct context *scheduler;   // swtch() here to enter scheduler
   struct taskstate ts;         // Used by x86 to find stack for interrupt
+  uint sysstack[256];          // sysenter lands here; top word is ts.esp0
   struct segdesc gdt[NSEGS];   // x86 global descriptor table
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
@@ -46,6 +47,16 @@ struct context {
   uint eip;
 };
 
+// A file mapped into the address space with mmap().
+struct vma {
+  uint addr;                   // First address, page aligned
+  uint len;                    // Bytes, a multiple of PGSIZE; 0 if unused
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // Mapped file
+  uint off;                    // File offset of addr
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -59,6 +70,9 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct waitq *wq;            // Queue it sleeps on, if any
+  struct proc *wqnext;         // Next on wq
+  struct sleeplock *waitlock;  // Sleeplock it is waiting for, if any
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -68,6 +82,7 @@ struct proc {
   int priority;                //priority in multilevel queues
   int flag;                   //getQ flag
   int cid;
+  struct vma vma[NVMA];        // Memory-mapped files
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -75,3 +90,4 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   files mapped with mmap(), from MMAPBASE up
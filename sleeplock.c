@@ -10,6 +10,10 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 
+// Cycles a locker spins, waiting for a holder that is running
+// on another CPU, before it goes to sleep.
+#define SPINCYCLES 20000
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -17,17 +21,60 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->wq.head = 0;
+  lk->stat = lockstatfor(name);
+}
+
+// Wait while lk is held by a process running on another CPU,
+// which may be about to release it, but for no more than
+// SPINCYCLES since t0.  A holder that is asleep, say for a
+// disk read, won't be back soon.  Called without lk->lk.
+static void
+spinwait(struct sleeplock *lk, uint t0)
+{
+  volatile struct sleeplock *v = lk;
+  struct proc *p;
+
+  while(v->locked && rdtsc() - t0 < SPINCYCLES){
+    // Procs are never freed, so p can be looked at even
+    // if it releases lk and exits meanwhile.
+    p = v->owner;
+    if(p && *(volatile enum procstate*)&p->state != RUNNING)
+      break;
+    pause();
+  }
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint t0;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  t0 = 0;
+  if(lk->locked){
+    t0 = rdtsc();
+    release(&lk->lk);
+    spinwait(lk, t0);
+    acquire(&lk->lk);
+    proc->waitlock = lk;
+    while (lk->locked) {
+      wqsleep(&lk->wq, &lk->lk);
+    }
+    proc->waitlock = 0;
   }
   lk->locked = 1;
   lk->pid = proc->pid;
+  lk->owner = proc;
+  lk->tacquire = rdtsc();
+  if(lk->stat){
+    lk->stat->c[cpu - cpus].nacquire++;
+    if(t0){
+      lk->stat->c[cpu - cpus].ncontend++;
+      lk->stat->c[cpu - cpus].spin += lk->tacquire - t0;
+    }
+  }
   release(&lk->lk);
 }
 
@@ -35,9 +82,12 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(lk->stat)
+    lk->stat->c[cpu - cpus].hold += rdtsc() - lk->tacquire;
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  wqwakeup(&lk->wq);
   release(&lk->lk);
 }
 
@@ -1,10 +1,23 @@
-// Long-term locks for processes
+// Processes sleeping until an event, linked through
+// struct proc and protected by the ptable lock.
+struct waitq {
+  struct proc *head;
+};
+
+// Long-term locks for processes.  A locker spins for a while
+// if the holder is running, then sleeps on wq.
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct waitq wq;   // processes waiting for it
+  struct proc *owner; // Process holding lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For statistics:
+  struct lockstat *stat;  // Counters shared by locks of this name
+  uint tacquire;     // Cycle counter when it was acquired
 };
 
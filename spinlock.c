@@ -9,12 +9,37 @@
 #include "proc.h"
 #include "spinlock.h"
 
+#define NLOCKSTAT 32
+
+static struct lockstat lockstats[NLOCKSTAT];
+
+// Find or make the counters for locks named name.  Runs
+// before there is any lock to protect lockstats[], so slots
+// are claimed with compare-and-swap.  Returns 0 if full.
+struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *ls;
+  char *n;
+
+  for(ls = lockstats; ls < &lockstats[NLOCKSTAT]; ls++){
+    n = ls->name;
+    if(n == 0)
+      n = __sync_val_compare_and_swap(&ls->name, 0, name);
+    if(n == 0 || n == name || strncmp(n, name, 16) == 0)
+      return ls;
+  }
+  return 0;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->stat = lockstatfor(name);
 }
 
 // Acquire the lock.
@@ -24,13 +49,21 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, t0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The xadd is atomic.  Only our own ticket coming up
+  // changes the line we spin on.
+  ticket = xadd(&lk->next, 1);
+  t0 = 0;
+  if(*(volatile uint*)&lk->owner != ticket){
+    t0 = rdtsc();
+    while(*(volatile uint*)&lk->owner != ticket)
+      pause();
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -39,7 +72,17 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for debugging.
   lk->cpu = cpu;
+  lk->tacquire = rdtsc();
+  if(lk->stat){
+    lk->stat->c[cpu - cpus].nacquire++;
+    if(t0){
+      lk->stat->c[cpu - cpus].ncontend++;
+      lk->stat->c[cpu - cpus].spin += lk->tacquire - t0;
+    }
+  }
+#ifdef LOCKDEBUG
   getcallerpcs(&lk, lk->pcs);
+#endif
 }
 
 // Release the lock.
@@ -49,6 +92,8 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->stat)
+    lk->stat->c[cpu - cpus].hold += rdtsc() - lk->tacquire;
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -59,14 +104,84 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Serve the next ticket.  Only the holder writes owner,
+  // so this needn't be atomic, but it must be one store.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
 
   popcli();
 }
 
+//PAGEBREAK: 30
+// Print each lock name's counters, summed over CPUs; cycle
+// counts are in units of 1024.  Runs when user types ^L on
+// console.  No lock, like procdump().
+void
+lockdump(void)
+{
+  struct lockstat *ls;
+  uint nacq, ncont;
+  uint64 spin, hold;
+  int i;
+
+  cprintf("lock            acquire  contend  kcyc-wait  kcyc-held\n");
+  for(ls = lockstats; ls < &lockstats[NLOCKSTAT] && ls->name; ls++){
+    nacq = ncont = 0;
+    spin = hold = 0;
+    for(i = 0; i < NCPU; i++){
+      nacq += ls->c[i].nacquire;
+      ncont += ls->c[i].ncontend;
+      spin += ls->c[i].spin;
+      hold += ls->c[i].hold;
+    }
+    cprintf("%s %d %d %d %d\n", ls->name, nacq, ncont,
+            (uint)(spin >> 10), (uint)(hold >> 10));
+  }
+}
+
+// Start changing data guarded by s.  Caller holds the
+// spinlock that serializes writers.
+void
+seqwbegin(struct seqcount *s)
+{
+  s->seq++;
+  __sync_synchronize();
+}
+
+// Done changing data guarded by s.
+void
+seqwend(struct seqcount *s)
+{
+  __sync_synchronize();
+  s->seq++;
+}
+
+// Start reading data guarded by s, without its lock.  Returns
+// a token for seqretry(): a typical use is
+//   do {
+//     t = seqbegin(&s);
+//     copy the data
+//   } while(seqretry(&s, t));
+// The reader must cope with garbage until seqretry() says
+// the copy is good, so it may copy but not follow pointers.
+uint
+seqbegin(struct seqcount *s)
+{
+  uint t;
+
+  while((t = *(volatile uint*)&s->seq) & 1)
+    pause();
+  __sync_synchronize();
+  return t;
+}
+
+// Did a writer change the data since seqbegin() returned t?
+int
+seqretry(struct seqcount *s, uint t)
+{
+  __sync_synchronize();
+  return *(volatile uint*)&s->seq != t;
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -89,7 +204,7 @@ getcallerpcs(void *v, uint pcs[])
 int
 holding(struct spinlock *lock)
 {
-  return lock->locked && lock->cpu == cpu;
+  return lock->owner != lock->next && lock->cpu == cpu;
 }
 
 
@@ -1,11 +1,38 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock.  A ticket lock: each acquirer takes
+// the next ticket and spins until owner reaches it, so the
+// lock goes to waiters in the order they arrived.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket now served; held if owner != next
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
-                     // that locked the lock.
+                     // that locked the lock, if built with LOCKDEBUG.
+
+  // For statistics:
+  struct lockstat *stat;  // Counters shared by locks of this name
+  uint tacquire;     // Cycle counter when it was acquired
+};
+
+// Counters for all the locks with one name, kept per CPU so
+// that updating them takes no atomic instructions.  Sleeplocks
+// count the time spent spinning and sleeping as spin.
+struct lockstat {
+  char *name;
+  struct {
+    uint nacquire;   // Acquisitions
+    uint ncontend;   // Acquisitions that had to wait
+    uint64 spin;     // Cycles spent waiting
+    uint64 hold;     // Cycles the lock was held
+  } c[NCPU];
 };
 
+// A sequence count, for data written under a spinlock and read
+// without it.  Writers bump seq before and after each change,
+// so it is odd while one is under way; a reader that saw seq
+// change while it looked retries.  See seqbegin().
+struct seqcount {
+  uint seq;
+};
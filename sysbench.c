@@ -0,0 +1,76 @@
+// Time getpid(): from the vdso page (the ulib.c version),
+// and round trips into the kernel, entering with sysenter
+// (as the usys.S stubs do) and with int $T_SYSCALL.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "syscall.h"
+#include "traps.h"
+
+#define N 10000
+
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+// getpid() the way the usys.S stubs enter the kernel.
+static int
+sysentergetpid(void)
+{
+  int pid;
+
+  asm volatile("movl %%esp, %%ecx; movl $1f, %%edx; sysenter; 1:" :
+               "=a" (pid) : "a" (SYS_getpid) : "ecx", "edx", "memory");
+  return pid;
+}
+
+// getpid() the old way.
+static int
+intgetpid(void)
+{
+  int pid;
+
+  asm volatile("int %1" : "=a" (pid) : "i" (T_SYSCALL), "a" (SYS_getpid) :
+               "memory");
+  return pid;
+}
+
+int
+main(void)
+{
+  uint t0, vdso, fast, slow;
+  int i, pid;
+
+  pid = getpid();
+  if(sysentergetpid() != pid || intgetpid() != pid){
+    printf(2, "sysbench: getpid %d, sysenter %d, int $T_SYSCALL %d\n",
+           pid, sysentergetpid(), intgetpid());
+    exit();
+  }
+
+  t0 = rdtsc();
+  for(i = 0; i < N; i++)
+    getpid();
+  vdso = rdtsc() - t0;
+
+  t0 = rdtsc();
+  for(i = 0; i < N; i++)
+    sysentergetpid();
+  fast = rdtsc() - t0;
+
+  t0 = rdtsc();
+  for(i = 0; i < N; i++)
+    intgetpid();
+  slow = rdtsc() - t0;
+
+  printf(1, "getpid vdso:     %d cycles\n", vdso / N);
+  printf(1, "getpid sysenter: %d cycles\n", fast / N);
+  printf(1, "getpid int:      %d cycles\n", slow / N);
+  exit();
+}
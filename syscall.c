@@ -48,17 +48,43 @@ argint(int n, int *ip)
   return fetchint(proc->tf->esp + 4 + 4*n, ip);
 }
 
+// Check that the size bytes at addr lie within the process
+// address space, or within files it has mapped; those pages
+// are faulted in now, so that the kernel does not take page
+// faults on them.  If write is set, the kernel may write the
+// memory, else it only reads it and it may be mapped read-only.
+int
+checkptr(uint addr, int size, int write)
+{
+  if(size < 0)
+    return -1;
+  if((addr >= proc->sz || addr+size > proc->sz) &&
+     mmapcheck(addr, size, write) < 0)
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// to a block of memory of size bytes, which the kernel may
+// write.  Check that the pointer is valid.
 int
 argptr(int n, char **pp, int size)
 {
   int i;
 
-  if(argint(n, &i) < 0)
+  if(argint(n, &i) < 0 || checkptr(i, size, 1) < 0)
     return -1;
-  if(size < 0 || (uint)i >= proc->sz || (uint)i+size > proc->sz)
+  *pp = (char*)i;
+  return 0;
+}
+
+// Like argptr, for memory the kernel only reads.
+int
+argrptr(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0 || checkptr(i, size, 0) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -102,6 +128,22 @@ extern int sys_getPerformanceData(void);
 extern int sys_nice(void);
 extern int sys_getQ(void);
 extern int sys_setcid(void);
+extern int sys_logstat(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_sendfile(void);
+extern int sys_fcntl(void);
+extern int sys_poll(void);
+extern int sys_epoll_create(void);
+extern int sys_epoll_ctl(void);
+extern int sys_epoll_wait(void);
+extern int sys_nanosleep(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -128,6 +170,22 @@ static int (*syscalls[])(void) = {
 [SYS_getPerformanceData]    sys_getPerformanceData,
 [SYS_nice]    sys_nice,
 [SYS_setcid] sys_setcid,
+[SYS_logstat] sys_logstat,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_sendfile] sys_sendfile,
+[SYS_fcntl]   sys_fcntl,
+[SYS_poll]    sys_poll,
+[SYS_epoll_create] sys_epoll_create,
+[SYS_epoll_ctl] sys_epoll_ctl,
+[SYS_epoll_wait] sys_epoll_wait,
+[SYS_nanosleep] sys_nanosleep,
 };
 
 void
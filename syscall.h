@@ -23,3 +23,19 @@
 #define SYS_getPerformanceData 22
 #define SYS_nice 23
 #define SYS_setcid 24
+#define SYS_logstat 25
+#define SYS_sync 26
+#define SYS_fsync 27
+#define SYS_mmap 28
+#define SYS_munmap 29
+#define SYS_readv 30
+#define SYS_writev 31
+#define SYS_pread 32
+#define SYS_pwrite 33
+#define SYS_sendfile 34
+#define SYS_fcntl  35
+#define SYS_poll   36
+#define SYS_epoll_create 37
+#define SYS_epoll_ctl 38
+#define SYS_epoll_wait 39
+#define SYS_nanosleep 40
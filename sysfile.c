@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "logstat.h"
+#include "uio.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -84,11 +87,128 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argrptr(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
 
+// Fetch the nth system call argument as an array of iovcnt
+// iovecs into iov, checking the buffers they describe.
+static int
+argiov(int n, int iovcnt, struct iovec *iov, int write)
+{
+  struct iovec *uiov;
+  int i, tot;
+
+  if(iovcnt < 0 || iovcnt > IOV_MAX ||
+     argrptr(n, (void*)&uiov, iovcnt*sizeof(*uiov)) < 0)
+    return -1;
+  memmove(iov, uiov, iovcnt*sizeof(*iov));
+  tot = 0;
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].len > 0x7fffffff - tot ||
+       checkptr((uint)iov[i].base, iov[i].len, write) < 0)
+      return -1;
+    tot += iov[i].len;
+  }
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argiov(1, n, iov, 1) < 0)
+    return -1;
+  return filereadv(f, iov, n, -1);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argiov(1, n, iov, 0) < 0)
+    return -1;
+  return filewritev(f, iov, n, -1);
+}
+
+// Copy from one file to another in the kernel.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
+// Read at an offset, leaving the file offset alone.
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, (void*)&iov.base, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argrptr(1, (void*)&iov.base, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Control an open file: get or set its O_NONBLOCK flag,
+// or the buffer size of a pipe.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    if(f->readable && f->writable)
+      return O_RDWR | f->flags;
+    return (f->writable ? O_WRONLY : O_RDONLY) | f->flags;
+  case F_SETFL:
+    f->flags = arg & O_NONBLOCK;
+    return 0;
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesize(f->pipe, 0);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE || arg <= 0)
+      return -1;
+    return pipesize(f->pipe, arg);
+  }
+  return -1;
+}
+
 int
 sys_close(void)
 {
@@ -117,7 +237,7 @@ sys_fstat(void)
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ+1], *new, *old;
   struct inode *dp, *ip;
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
@@ -163,29 +283,12 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 //PAGEBREAK!
 int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ+1], *path;
   uint off;
 
   if(argstr(0, &path) < 0)
@@ -214,9 +317,8 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, off);
+  dcacheforget(dp->dev, dp->inum, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -242,7 +344,7 @@ create(char *path, short type, short major, short minor)
 {
   uint off;
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
@@ -267,19 +369,31 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto fail;
   }
 
+  // dp may be full, or removed.
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+ fail:
+  // Free ip again.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
 int
@@ -307,7 +421,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & (O_WRONLY|O_RDWR))){
       iunlockput(ip);
       end_op();
       return -1;
@@ -327,6 +441,7 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->flags = omode & O_NONBLOCK;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -441,3 +556,122 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_logstat(void)
+{
+  struct logstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  logstat(st);
+  return 0;
+}
+
+// Make all file system changes so far durable.
+int
+sys_sync(void)
+{
+  log_sync();
+  return 0;
+}
+
+// Make the changes to an open file durable.  The log is
+// shared, so this commits everyone's changes.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Map a file into memory.  The address argument is only a
+// hint, and is ignored.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int len, prot, flags, off;
+
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Wait for one of several descriptors to be ready.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  int n, timeout;
+
+  if(argint(1, &n) < 0 || argint(2, &timeout) < 0 || n < 0 || n > NOFILE ||
+     argptr(0, (void*)&fds, n*sizeof(struct pollfd)) < 0)
+    return -1;
+  return poll(fds, n, timeout);
+}
+
+int
+sys_epoll_create(void)
+{
+  struct file *f;
+  struct epoll *ep;
+  int fd;
+
+  ep = 0;
+  if((f = filealloc()) == 0 || (ep = epollalloc()) == 0 || (fd = fdalloc(f)) < 0){
+    if(ep)
+      epollclose(ep);
+    if(f)
+      fileclose(f);
+    return -1;
+  }
+  f->type = FD_EPOLL;
+  f->flags = 0;
+  f->readable = 0;
+  f->writable = 0;
+  f->ep = ep;
+  return fd;
+}
+
+int
+sys_epoll_ctl(void)
+{
+  struct file *epf, *f;
+  struct epoll_event *ev;
+  int op;
+
+  if(argfd(0, 0, &epf) < 0 || argint(1, &op) < 0 || argfd(2, 0, &f) < 0 ||
+     argptr(3, (void*)&ev, sizeof(*ev)) < 0 || epf->type != FD_EPOLL)
+    return -1;
+  return epollctl(epf->ep, op, f, ev);
+}
+
+int
+sys_epoll_wait(void)
+{
+  struct file *f;
+  struct epoll_event *evs;
+  int n, timeout;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argint(3, &timeout) < 0 ||
+     n <= 0 || argptr(1, (void*)&evs, n*sizeof(struct epoll_event)) < 0 ||
+     f->type != FD_EPOLL)
+    return -1;
+  return epollwait(f->ep, evs, n, timeout);
+}
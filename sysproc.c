@@ -60,21 +60,20 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(proc->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepticks(n);
+}
+
+int
+sys_nanosleep(void)
+{
+  int sec, nsec;
+
+  if(argint(0, &sec) < 0 || argint(1, &nsec) < 0)
+    return -1;
+  return nanosleep(sec, nsec);
 }
 
 // return how many clock tick interrupts have occurred
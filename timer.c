@@ -1,11 +1,12 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
-// Only used on uniprocessors;
-// SMP machines use the local APIC timer.
+// Counter 0 is the clock on uniprocessors; SMP machines
+// use the local APIC timer, calibrated against counter 2.
 
 #include "types.h"
 #include "defs.h"
 #include "traps.h"
 #include "x86.h"
+#include "param.h"
 
 #define IO_TIMER1       0x040           // 8253 Timer #1
 
@@ -20,13 +21,40 @@
 #define TIMER_SEL0      0x00    // select counter 0
 #define TIMER_RATEGEN   0x04    // mode 2, rate generator
 #define TIMER_16BIT     0x30    // r/w counter 16 bits, LSB first
+#define TIMER_SEL2      0x80    // select counter 2
+#define TIMER_INTTC     0x00    // mode 0, interrupt on terminal count
+
+#define IO_TIMER2       (IO_TIMER1 + 2) // counter 2
+#define IO_PPI          0x061           // counter 2 gate and output
+#define PPI_GATE2       0x01    // counter 2 gate
+#define PPI_SPKR        0x02    // speaker enable
+#define PPI_OUT2        0x20    // counter 2 output
 
 void
 timerinit(void)
 {
-  // Interrupt 100 times/sec.
+  // Interrupt HZ times/sec.
   outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-  outb(IO_TIMER1, TIMER_DIV(100) % 256);
-  outb(IO_TIMER1, TIMER_DIV(100) / 256);
+  outb(IO_TIMER1, TIMER_DIV(HZ) % 256);
+  outb(IO_TIMER1, TIMER_DIV(HZ) / 256);
   picenable(IRQ_TIMER);
 }
+
+// Busy-wait one clock tick, 1/HZ of a second, on counter 2,
+// which is not wired to an interrupt.  Used to calibrate
+// the local APIC timer.
+void
+timerwait(void)
+{
+  uchar ppi;
+
+  ppi = inb(IO_PPI) & ~(PPI_GATE2 | PPI_SPKR);
+  outb(IO_PPI, ppi);
+  outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+  outb(IO_TIMER2, TIMER_DIV(HZ) % 256);
+  outb(IO_TIMER2, TIMER_DIV(HZ) / 256);
+  outb(IO_PPI, ppi | PPI_GATE2);   // start counting
+  while((inb(IO_PPI) & PPI_OUT2) == 0)
+    ;
+  outb(IO_PPI, ppi);
+}
@@ -7,12 +7,15 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern void sysentry(void);  // in trapasm.S
 struct spinlock tickslock;
 uint ticks;
+int diskirq = IRQ_IDE;  // set by disk drivers whose IRQ is not fixed
 
 void
 tvinit(void)
@@ -32,6 +35,44 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// A system call that came in through sysentry.
+void
+fastsyscall(struct trapframe *tf)
+{
+  if(proc->killed)
+    exit();
+  proc->tf = tf;
+  syscall();
+  if(proc->killed)
+    exit();
+}
+
+// Handle the traps sysenter can cause.  Returns 1 if tf was one.
+static int
+sysentertrap(struct trapframe *tf)
+{
+  // sysenter doesn't clear FL_TF, so a process single-stepping
+  // into a system call traps on sysentry's first instruction,
+  // on this CPU's sysstack.  Stop it; sysexit leaves it clear.
+  if(tf->trapno == T_DEBUG && (tf->cs&3) == 0 && tf->eip == (uint)sysentry &&
+     (tf->eflags & FL_TF)){
+    tf->eflags &= ~FL_TF;
+    return 1;
+  }
+  // A CPU without sysenter finds it illegal; do what
+  // sysentry and sysexit would have.
+  if(tf->trapno == T_ILLOP && !sysenterok && proc && (tf->cs&3) == DPL_USER &&
+     tf->eip + 2 <= proc->sz && *(ushort*)tf->eip == 0x340f){
+    tf->eip = tf->edx;
+    tf->esp = tf->ecx;
+    tf->eflags &= ~FL_TF;
+    proc->tf = tf;
+    syscall();
+    return 1;
+  }
+  return 0;
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
@@ -57,7 +98,7 @@ trap(struct trapframe *tf)
           proc->rtime++;
           
       }
-      wakeup(&ticks);
+      callouttick();
       release(&tickslock);
     }
     lapiceoi();
@@ -84,8 +125,21 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Bit 1 of the error code is set for a write.
+    if(proc && (tf->cs&3) == DPL_USER && mmapfault(rcr2(), tf->err & 2) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
+    if(tf->trapno == T_IRQ0 + diskirq){
+      ideintr();
+      lapiceoi();
+      break;
+    }
+    if(sysentertrap(tf))
+      break;
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -0,0 +1,7 @@
+// A buffer of a vector passed to readv() and writev().
+struct iovec {
+  void *base;       // start of the buffer
+  uint len;         // its length in bytes
+};
+
+#define IOV_MAX 16  // most buffers in one vector
@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "vdso.h"
 
 char*
 strcpy(char *s, char *t)
@@ -103,3 +104,46 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+int
+getpid(void)
+{
+  return ((struct vdsoproc*)VDSOPROC)->pid;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct vdsodata*)VDSO)->ticks;
+}
+
+// Time since boot.  Between ticks it is interpolated with the
+// cycle counter, to the microsecond, once the kernel has
+// measured the cycles per tick.
+void
+nanouptime(int *sec, int *nsec)
+{
+  volatile struct vdsodata *vd;
+  uint seq, t, tsc, tsctick, hz, now, nstick, ns;
+
+  vd = (struct vdsodata*)VDSO;
+  do {
+    while((seq = vd->seq) & 1)
+      ;
+    t = vd->ticks;
+    tsc = vd->tsc;
+    tsctick = vd->tsctick;
+    hz = vd->hz;
+    now = rdtsc();
+  } while(vd->seq != seq);
+
+  nstick = 1000000000 / hz;
+  ns = 0;
+  if(tsctick / (nstick/1000) > 0){
+    ns = (now - tsc) / (tsctick / (nstick/1000)) * 1000;
+    if(ns >= nstick)
+      ns = nstick - 1;  // the next tick is late
+  }
+  *sec = t / hz;
+  *nsec = t % hz * nstick + ns;
+}
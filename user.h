@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct logstat;
+struct iovec;
+struct pollfd;
+struct epoll_event;
 
 // system calls
 int fork(void);
@@ -19,13 +23,27 @@ int link(char*, char*);
 int mkdir(char*);
 int chdir(char*);
 int dup(int);
-int getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
 int getPerformanceData(int*,int*);
 int nice(void);
 int setcid(int);
+int logstat(struct logstat*);
+int sync(void);
+int fsync(int);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int sendfile(int, int, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
+int epoll_create(void);
+int epoll_ctl(int, int, int, struct epoll_event*);
+int epoll_wait(int, struct epoll_event*, int, int);
+int nanosleep(int, int);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -40,3 +58,6 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int getpid(void);
+int uptime(void);
+void nanouptime(int*, int*);
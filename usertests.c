@@ -7,6 +7,10 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "mmu.h"
+#include "uio.h"
+#include "poll.h"
+#include "vdso.h"
 
 char buf[8192];
 char name[3];
@@ -354,6 +358,438 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// grow a pipe's buffer while it holds data.
+void
+pipesize(void)
+{
+  int fds[2], fd, i, n, pos;
+
+  printf(1, "pipesize test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < 8192; i++)
+    buf[i] = i % 251;
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != 4096 || write(fds[1], buf, 4096) != 4096){
+    printf(1, "pipesize default size wrong\n");
+    exit();
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 10000) != 16384 ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != 16384){
+    printf(1, "pipesize grow failed\n");
+    exit();
+  }
+  // would block forever if the pipe had not grown.
+  if(write(fds[1], buf, 8192) != 8192){
+    printf(1, "pipesize write failed\n");
+    exit();
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 4096) >= 0 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 1 << 30) >= 0){
+    printf(1, "pipesize bad size accepted\n");
+    exit();
+  }
+  fd = open("README", 0);
+  if(fd < 0 || fcntl(fd, F_GETPIPE_SZ, 0) >= 0){
+    printf(1, "pipesize on a file worked!\n");
+    exit();
+  }
+  close(fd);
+  close(fds[1]);
+  pos = 0;
+  while((n = read(fds[0], buf, 3000)) > 0){
+    for(i = 0; i < n; i++, pos++){
+      if((uchar)buf[i] != (pos < 4096 ? pos : pos - 4096) % 251){
+        printf(1, "pipesize wrong data at %d\n", pos);
+        exit();
+      }
+    }
+  }
+  close(fds[0]);
+  if(pos != 4096 + 8192){
+    printf(1, "pipesize read %d bytes\n", pos);
+    exit();
+  }
+  printf(1, "pipesize ok\n");
+}
+
+// a big write to a pipe with a waiting reader lends
+// the writer's pages instead of copying through the ring,
+// so the write returns only once all of it has been read.
+void
+pipelend(void)
+{
+  int fds[2], fd, i, n, m, pos, pid;
+
+  printf(1, "pipelend test\n");
+  unlink("lenddone");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < 8192; i++)
+      buf[i] = i % 253;
+    sleep(1);  // let the parent block in read()
+    if(write(fds[1], buf + 1, 8191) != 8191){
+      printf(1, "pipelend write failed\n");
+      exit();
+    }
+    // tell the parent the first write has returned.
+    if((fd = open("lenddone", O_CREATE|O_RDWR)) < 0){
+      printf(1, "pipelend create failed\n");
+      exit();
+    }
+    close(fd);
+    if(write(fds[1], buf, 8192) != 8192){
+      printf(1, "pipelend write failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[1]);
+  pos = 0;
+  for(;;){
+    // stop 1000 bytes short of the end of the first write.
+    m = 1000;
+    if(pos < 7191 && pos + m > 7191)
+      m = 7191 - pos;
+    if((n = read(fds[0], buf, m)) <= 0)
+      break;
+    for(i = 0; i < n; i++, pos++){
+      if((uchar)buf[i] != (pos < 8191 ? pos + 1 : pos - 8191) % 253){
+        printf(1, "pipelend wrong data at %d\n", pos);
+        exit();
+      }
+    }
+    // copied through the ring, the rest of the first write
+    // would fit, and the writer would have moved on.
+    if(pos == 7191){
+      sleep(5);
+      if((fd = open("lenddone", 0)) >= 0){
+        printf(1, "pipelend write returned before it was read\n");
+        exit();
+      }
+    }
+  }
+  close(fds[0]);
+  wait();
+  if(pos != 8191 + 8192){
+    printf(1, "pipelend read %d bytes\n", pos);
+    exit();
+  }
+  if(unlink("lenddone") != 0){
+    printf(1, "pipelend: first write never returned\n");
+    exit();
+  }
+  printf(1, "pipelend ok\n");
+}
+
+void
+polltest(void)
+{
+  int p1[2], p2[2], ep, pid, t0;
+  struct pollfd fds[2];
+  struct epoll_event ev, evs[4];
+
+  printf(1, "poll test\n");
+  if(pipe(p1) != 0 || pipe(p2) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  fds[0].fd = p1[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = p2[0];
+  fds[1].events = POLLIN;
+  if(poll(fds, 2, 0) != 0){
+    printf(1, "poll of empty pipes not 0\n");
+    exit();
+  }
+  write(p2[1], "x", 1);
+  if(poll(fds, 2, 0) != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+    printf(1, "poll missed a ready pipe\n");
+    exit();
+  }
+  read(p2[0], buf, 1);
+
+  // non-blocking descriptors.
+  if(fcntl(p1[0], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(p1[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+     read(p1[0], buf, 1) != -1){
+    printf(1, "non-blocking read failed\n");
+    exit();
+  }
+  fcntl(p2[1], F_SETFL, O_NONBLOCK);
+  if(write(p2[1], buf, 8192) != 4096 || write(p2[1], buf, 1) != -1){
+    printf(1, "non-blocking write failed\n");
+    exit();
+  }
+  fds[1].fd = p2[1];
+  fds[1].events = POLLOUT;
+  if(poll(fds + 1, 1, 0) != 0){
+    printf(1, "poll says a full pipe is writable\n");
+    exit();
+  }
+  if(read(p2[0], buf, sizeof(buf)) != 4096 || poll(fds + 1, 1, 0) != 1){
+    printf(1, "poll says a drained pipe is not writable\n");
+    exit();
+  }
+  fcntl(p1[0], F_SETFL, 0);
+
+  // timeouts.
+  t0 = uptime();
+  if(poll(fds, 1, 2) != 0 || uptime() - t0 < 2){
+    printf(1, "poll timeout failed\n");
+    exit();
+  }
+
+  // wake up when another process writes.
+  pid = fork();
+  if(pid == 0){
+    sleep(2);
+    write(p1[1], "y", 1);
+    exit();
+  }
+  if(poll(fds, 1, -1) != 1 || fds[0].revents != POLLIN){
+    printf(1, "poll not woken by write\n");
+    exit();
+  }
+  wait();
+
+  // epoll: level-triggered, and only ready files reported.
+  if((ep = epoll_create()) < 0){
+    printf(1, "epoll_create failed\n");
+    exit();
+  }
+  ev.events = POLLIN;
+  ev.data = 1;
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, p1[0], &ev) != 0){
+    printf(1, "epoll_ctl add failed\n");
+    exit();
+  }
+  ev.data = 2;
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, p2[0], &ev) != 0 ||
+     epoll_ctl(ep, EPOLL_CTL_ADD, p2[0], &ev) == 0){
+    printf(1, "epoll_ctl add twice wrong\n");
+    exit();
+  }
+  if(epoll_wait(ep, evs, 4, 0) != 1 || evs[0].data != 1 ||
+     epoll_wait(ep, evs, 4, 0) != 1){
+    printf(1, "epoll_wait missed a ready pipe\n");
+    exit();
+  }
+  read(p1[0], buf, 1);
+  if(epoll_wait(ep, evs, 4, 0) != 0){
+    printf(1, "epoll_wait reported a drained pipe\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    sleep(2);
+    write(p2[1], "z", 1);
+    exit();
+  }
+  if(epoll_wait(ep, evs, 4, -1) != 1 || evs[0].data != 2 || evs[0].events != POLLIN){
+    printf(1, "epoll_wait not woken by write\n");
+    exit();
+  }
+  wait();
+  read(p2[0], buf, 1);
+  close(p1[1]);
+  if(epoll_wait(ep, evs, 4, 0) != 1 || evs[0].data != 1 || evs[0].events != POLLHUP){
+    printf(1, "epoll_wait missed a hangup\n");
+    exit();
+  }
+  if(epoll_ctl(ep, EPOLL_CTL_DEL, p1[0], &ev) != 0 ||
+     epoll_wait(ep, evs, 4, 0) != 0){
+    printf(1, "epoll_ctl del failed\n");
+    exit();
+  }
+  close(ep);
+  close(p1[0]);
+  close(p2[0]);
+  close(p2[1]);
+  printf(1, "poll ok\n");
+}
+
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+// Cycles of the time-stamp counter per clock tick,
+// averaged over a few ticks.
+static uint
+tsctick(void)
+{
+  int t;
+  uint c0;
+
+  t = uptime();
+  while(uptime() == t)
+    ;
+  c0 = rdtsc();
+  t = uptime();
+  while(uptime() < t + 5)
+    ;
+  return (rdtsc() - c0) / 5;
+}
+
+void
+nanosleeptest(void)
+{
+  int t0, i, pid, fds[2];
+  uint cyc, c0;
+  char c;
+
+  printf(1, "nanosleep test\n");
+  t0 = uptime();
+  if(nanosleep(0, 30000000) != 0 || uptime() - t0 < 3){
+    printf(1, "nanosleep too short\n");
+    exit();
+  }
+  if(nanosleep(0, 50000) != 0 || nanosleep(0, -1) != -1 ||
+     nanosleep(0, 1000000000) != -1){
+    printf(1, "nanosleep arguments\n");
+    exit();
+  }
+
+  // a tick and a half is never cut short, wherever in
+  // a tick the sleep starts.
+  cyc = tsctick();
+  for(i = 0; i < 5; i++){
+    c0 = rdtsc();
+    while(rdtsc() - c0 < cyc/5*i)
+      ;
+    c0 = rdtsc();
+    if(nanosleep(0, NSTICK*3/2) != 0){
+      printf(1, "nanosleep failed\n");
+      exit();
+    }
+    if((c0 = rdtsc() - c0) < cyc*3/2 - cyc/20){
+      printf(1, "nanosleep woke after %d of %d cycles\n", c0, cyc*3/2);
+      exit();
+    }
+  }
+
+  // sleepers wake in deadline order, whatever order they slept in.
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid == 0){
+      sleep(2 + 3*(3 - i));
+      c = '0' + i;
+      write(fds[1], &c, 1);
+      exit();
+    }
+  }
+  close(fds[1]);
+  for(i = 3; i >= 0; i--){
+    if(read(fds[0], &c, 1) != 1 || c != '0' + i){
+      printf(1, "sleepers woke out of order\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  for(i = 0; i < 4; i++)
+    wait();
+  printf(1, "nanosleep ok\n");
+}
+
+// getpid(), uptime() and nanouptime() read the vdso pages.
+void
+vdsotest(void)
+{
+  int pid, cpid, fds[2], t0, s0, n0, s1, n1;
+
+  printf(1, "vdso test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    cpid = getpid();
+    write(fds[1], &cpid, sizeof(cpid));
+    *(int*)VDSO = 0;  // read-only: should be killed
+    write(fds[1], &cpid, sizeof(cpid));
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &cpid, sizeof(cpid)) != sizeof(cpid) || cpid != pid){
+    printf(1, "vdso: child getpid() is not fork()'s pid\n");
+    exit();
+  }
+  if(read(fds[0], &cpid, sizeof(cpid)) != 0){
+    printf(1, "vdso: page is writable\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+
+  nanouptime(&s0, &n0);
+  t0 = uptime();
+  sleep(3);
+  nanouptime(&s1, &n1);
+  if(uptime() - t0 < 3 || (s1 - s0) * 1000 + (n1 - n0) / 1000000 < 20){
+    printf(1, "vdso: clock did not advance\n");
+    exit();
+  }
+  if(n1 < 0 || n1 >= 1000000000){
+    printf(1, "vdso: bad nanouptime %d.%d\n", s1, n1);
+    exit();
+  }
+  printf(1, "vdso ok\n");
+}
+
+// Enter the kernel with sysenter while single-stepping.
+// The debug trap lands on sysentry's first instruction,
+// which must neither corrupt the kernel nor kill the child.
+void
+sysentertf(void)
+{
+  int pid, cpid, fds[2];
+
+  printf(1, "sysenter tf test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    // popfl sets TF one instruction late, so the
+    // trap comes just after sysenter, in the kernel.
+    asm volatile("movl %%esp, %%ecx; movl $1f, %%edx; "
+                 "pushfl; orl %2, (%%esp); popfl; sysenter; 1:" :
+                 "=a" (cpid) : "a" (SYS_getpid), "i" (FL_TF) :
+                 "ecx", "edx", "memory", "cc");
+    write(fds[1], &cpid, sizeof(cpid));
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &cpid, sizeof(cpid)) != sizeof(cpid) || cpid != pid){
+    printf(1, "sysenter tf: child did not return from getpid()\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(1, "sysenter tf ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -765,12 +1201,9 @@ void
 concreate(void)
 {
   char file[3];
-  int i, pid, n, fd;
-  char fa[40];
-  struct {
-    ushort inum;
-    char name[14];
-  } de;
+  int i, pid, n, fd, off;
+  char fa[40], blk[BSIZE];
+  struct dirent *de;
 
   printf(1, "concreate test\n");
   file[0] = 'C';
@@ -800,21 +1233,26 @@ concreate(void)
   memset(fa, 0, sizeof(fa));
   fd = open(".", 0);
   n = 0;
-  while(read(fd, &de, sizeof(de)) > 0){
-    if(de.inum == 0)
-      continue;
-    if(de.name[0] == 'C' && de.name[2] == '\0'){
-      i = de.name[1] - '0';
-      if(i < 0 || i >= sizeof(fa)){
-        printf(1, "concreate weird file %s\n", de.name);
-        exit();
-      }
-      if(fa[i]){
-        printf(1, "concreate duplicate file %s\n", de.name);
-        exit();
+  while(read(fd, blk, BSIZE) == BSIZE){
+    for(off = 0; off < BSIZE; off += de->reclen){
+      de = (struct dirent*)(blk + off);
+      if(de->reclen == 0)
+        break;
+      if(de->inum == 0)
+        continue;
+      if(de->namelen == 2 && de->name[0] == 'C'){
+        i = de->name[1] - '0';
+        if(i < 0 || i >= sizeof(fa)){
+          printf(1, "concreate weird file C%c\n", de->name[1]);
+          exit();
+        }
+        if(fa[i]){
+          printf(1, "concreate duplicate file C%c\n", de->name[1]);
+          exit();
+        }
+        fa[i] = 1;
+        n++;
       }
-      fa[i] = 1;
-      n++;
     }
   }
   close(fd);
@@ -852,6 +1290,78 @@ concreate(void)
   printf(1, "concreate ok\n");
 }
 
+// Set the first four characters of the name in path
+// (after "dfull/") to n.
+static void
+dirfullname(char *path, int n)
+{
+  path[6] = '0' + n / 1000;
+  path[7] = '0' + n / 100 % 10;
+  path[8] = '0' + n / 10 % 10;
+  path[9] = '0' + n % 10;
+}
+
+// Adding names to a directory until there is no room must
+// fail cleanly, for links and for new files and directories;
+// so must adding names to a directory that has been removed.
+void
+dirfull(void)
+{
+  char path[6+DIRSIZ+1];
+  int fd, i, n;
+
+  printf(1, "dirfull test\n");
+  if(mkdir("dfull") != 0 || (fd = open("dfull/f", O_CREATE|O_RDWR)) < 0){
+    printf(1, "dirfull: create dfull/f failed\n");
+    exit();
+  }
+  close(fd);
+
+  // Names as long as can be fill it soonest.
+  memmove(path, "dfull/", 6);
+  memset(path+6, 'a', DIRSIZ);
+  path[6+DIRSIZ] = 0;
+  for(n = 0; n < 10000; n++){
+    dirfullname(path, n);
+    if(link("dfull/f", path) != 0)
+      break;
+  }
+  if(n == 10000){
+    printf(1, "dirfull: directory never filled\n");
+    exit();
+  }
+  // The name that didn't fit still doesn't.
+  if(open(path, O_CREATE|O_RDWR) >= 0 || mkdir(path) == 0){
+    printf(1, "dirfull: created in a full directory\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    dirfullname(path, i);
+    if(unlink(path) != 0){
+      printf(1, "dirfull: unlink failed\n");
+      exit();
+    }
+  }
+  if(unlink("dfull/f") != 0 || unlink("dfull") != 0){
+    printf(1, "dirfull: unlink dfull failed\n");
+    exit();
+  }
+
+  if(mkdir("dgone") != 0 || chdir("dgone") != 0 || unlink("../dgone") != 0){
+    printf(1, "dirfull: mkdir/chdir/unlink dgone failed\n");
+    exit();
+  }
+  if(open("x", O_CREATE|O_RDWR) >= 0 || mkdir("y") == 0){
+    printf(1, "dirfull: created in a removed directory\n");
+    exit();
+  }
+  if(chdir("..") != 0){
+    printf(1, "dirfull: chdir .. failed\n");
+    exit();
+  }
+  printf(1, "dirfull ok\n");
+}
+
 // another concurrent link/unlink/create test,
 // to look for deadlocks.
 void
@@ -1201,44 +1711,63 @@ bigfile(void)
 }
 
 void
-fourteen(void)
+longname(void)
 {
+  char name[DIRSIZ+2];
   int fd;
 
-  // DIRSIZ is 14.
-  printf(1, "fourteen test\n");
+  printf(1, "longname test\n");
 
+  // Names no longer get cut short at 14 bytes.
   if(mkdir("12345678901234") != 0){
     printf(1, "mkdir 12345678901234 failed\n");
     exit();
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf(1, "mkdir 12345678901234/123456789012345 failed\n");
+  if(mkdir("123456789012345") != 0){
+    printf(1, "mkdir 123456789012345 failed\n");
     exit();
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  fd = open("123456789012345/123456789012345", O_CREATE);
   if(fd < 0){
-    printf(1, "create 123456789012345/123456789012345/123456789012345 failed\n");
+    printf(1, "create 123456789012345/123456789012345 failed\n");
     exit();
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  if(open("12345678901234/123456789012345", 0) >= 0){
+    printf(1, "open 12345678901234/123456789012345 succeeded!\n");
+    exit();
+  }
+
+  memset(name, 'x', DIRSIZ);
+  name[DIRSIZ] = 0;
+  fd = open(name, O_CREATE|O_RDWR);
   if(fd < 0){
-    printf(1, "open 12345678901234/12345678901234/12345678901234 failed\n");
+    printf(1, "create %d-byte name failed\n", DIRSIZ);
     exit();
   }
   close(fd);
-
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf(1, "mkdir 12345678901234/12345678901234 succeeded!\n");
+  if((fd = open(name, 0)) < 0){
+    printf(1, "open %d-byte name failed\n", DIRSIZ);
     exit();
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf(1, "mkdir 12345678901234/123456789012345 succeeded!\n");
+  close(fd);
+  name[DIRSIZ] = 'x';
+  name[DIRSIZ+1] = 0;
+  if(open(name, O_CREATE) >= 0){
+    printf(1, "create %d-byte name succeeded!\n", DIRSIZ+1);
+    exit();
+  }
+  name[DIRSIZ] = 0;
+
+  if(unlink(name) != 0 ||
+     unlink("123456789012345/123456789012345") != 0 ||
+     unlink("123456789012345") != 0 ||
+     unlink("12345678901234") != 0){
+    printf(1, "longname unlink failed\n");
     exit();
   }
 
-  printf(1, "fourteen ok\n");
+  printf(1, "longname ok\n");
 }
 
 void
@@ -1280,6 +1809,337 @@ rmdot(void)
   printf(1, "rmdot ok\n");
 }
 
+// sync and fsync commit the log; fsync wants a file.
+void
+synctest(void)
+{
+  int fd, fds[2];
+
+  printf(1, "sync test\n");
+  fd = open("synced", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create synced failed\n");
+    exit();
+  }
+  if(write(fd, "x", 1) != 1 || fsync(fd) != 0){
+    printf(1, "fsync synced failed\n");
+    exit();
+  }
+  close(fd);
+  if(fsync(fd) >= 0){
+    printf(1, "fsync of closed fd succeeded\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fsync(fds[0]) >= 0){
+    printf(1, "fsync of pipe succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(unlink("synced") != 0 || sync() != 0){
+    printf(1, "sync failed\n");
+    exit();
+  }
+  printf(1, "sync test ok\n");
+}
+
+// mapped files: private mappings copy on write, stores to
+// shared ones reach the file and other processes, and
+// read() and write() work on mapped memory.
+void
+mmaptest(void)
+{
+  int fd, fd2, i, pid;
+  char *p, *q, c;
+
+  printf(1, "mmap test\n");
+  fd = open("mapped", O_CREATE|O_RDWR);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "create mapped failed\n");
+    exit();
+  }
+
+  p = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf(1, "mmap private failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(p[i] != buf[i]){
+      printf(1, "mapped data wrong\n");
+      exit();
+    }
+  }
+  p[0] = 'X';
+  fd2 = open("mapped", O_RDWR);
+  if(read(fd2, &c, 1) != 1 || c != 'a'){
+    printf(1, "private store reached the file\n");
+    exit();
+  }
+  close(fd2);
+
+  q = mmap(0, sizeof(buf), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(q == (char*)-1 || q == p || q[0] != 'a'){
+    printf(1, "mmap shared failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    q[0] = 'Y';
+    exit();
+  }
+  wait();
+  fd2 = open("mapped", O_RDWR);
+  if(q[0] != 'Y' || p[0] != 'X' || read(fd2, &c, 1) != 1 || c != 'Y'){
+    printf(1, "shared store lost\n");
+    exit();
+  }
+
+  // read() into and write() from mapped memory.
+  if(read(fd2, q + PGSIZE, 1) != 1 || write(fd2, q, 1) != 1 || q[2] != 'Y'){
+    printf(1, "read/write of mapped memory failed\n");
+    exit();
+  }
+  close(fd2);
+  if(munmap(q, sizeof(buf)) != 0 || munmap(p, sizeof(buf)) != 0 ||
+     munmap(p, sizeof(buf)) == 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+  close(fd);
+
+  p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  fd = open("mapped", O_RDONLY);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p != (char*)-1 || q != (char*)-1){
+    printf(1, "mmap of bad fd succeeded\n");
+    exit();
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, PGSIZE);
+  if(p == (char*)-1 || p[0] != 'b' || read(fd, p, 1) >= 0){
+    printf(1, "mmap read-only failed\n");
+    exit();
+  }
+  munmap(p, PGSIZE);
+  close(fd);
+  unlink("mapped");
+  printf(1, "mmap test ok\n");
+}
+
+// readv and writev move several buffers at once; pread and
+// pwrite leave the file offset alone.
+void
+uiovtest(void)
+{
+  struct iovec iov[3];
+  char a[4], b[2000], c[3];
+  int fd, i;
+
+  printf(1, "iovec test\n");
+  fd = open("iovec", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create iovec failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i;
+  iov[0].base = "abcd";
+  iov[0].len = 4;
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = "xyz";
+  iov[2].len = 3;
+  if(writev(fd, iov, 3) != 4 + sizeof(b) + 3){
+    printf(1, "writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "B", 1, 1) != 1 || pread(fd, c, 3, 0) != 3 ||
+     c[0] != 'a' || c[1] != 'B' || c[2] != 'c'){
+    printf(1, "pread/pwrite failed\n");
+    exit();
+  }
+  if(write(fd, "!", 1) != 1 || pread(fd, c, 3, 4 + sizeof(b) + 2) != 2 ||
+     c[0] != 'z' || c[1] != '!'){
+    printf(1, "pwrite moved the offset\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("iovec", O_RDONLY);
+  memset(b, 0, sizeof(b));
+  iov[0].base = a;
+  iov[0].len = 4;
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = c;
+  iov[2].len = 3;
+  if(readv(fd, iov, 3) != 4 + sizeof(b) + 3 || a[1] != 'B' ||
+     b[sizeof(b)-1] != (char)(sizeof(b)-1) || c[0] != 'x'){
+    printf(1, "readv failed\n");
+    exit();
+  }
+  if(readv(fd, iov, IOV_MAX+1) >= 0 || readv(fd, iov, 3) != 1 ||
+     a[0] != '!' || readv(fd, iov, 3) != 0){
+    printf(1, "readv past the end failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("iovec");
+  printf(1, "iovec test ok\n");
+}
+
+// sendfile copies between files and pipes in the kernel.
+void
+sendfiletest(void)
+{
+  int fd, fd2, fds[2], i, n, pid;
+
+  printf(1, "sendfile test\n");
+  fd = open("sendsrc", O_CREATE|O_RDWR);
+  for(i = 0; i < 3000; i++)
+    buf[i] = 'a' + i % 23;
+  if(fd < 0 || write(fd, buf, 3000) != 3000){
+    printf(1, "create sendsrc failed\n");
+    exit();
+  }
+  close(fd);
+
+  // file to file, stopping at the end of the source.
+  fd = open("sendsrc", O_RDONLY);
+  fd2 = open("senddst", O_CREATE|O_RDWR);
+  if(sendfile(fd2, fd, 1000) != 1000 || sendfile(fd2, fd, 10000) != 2000 ||
+     sendfile(fd2, fd, 10) != 0 || sendfile(fd, fd2, 10) >= 0){
+    printf(1, "sendfile file to file failed\n");
+    exit();
+  }
+  close(fd);
+  close(fd2);
+
+  // file to pipe to file.
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("senddst", O_RDONLY);
+    while(sendfile(fds[1], fd, 4096) > 0)
+      ;
+    exit();
+  }
+  close(fds[1]);
+  fd = open("sendout", O_CREATE|O_RDWR);
+  n = 0;
+  while((i = sendfile(fd, fds[0], 4096)) > 0)
+    n += i;
+  wait();
+  close(fds[0]);
+  close(fd);
+  if(n != 3000){
+    printf(1, "sendfile through pipe moved %d\n", n);
+    exit();
+  }
+
+  fd = open("sendout", O_RDONLY);
+  if(read(fd, buf + 3000, 3000) != 3000){
+    printf(1, "read sendout failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < 3000; i++){
+    if(buf[i] != buf[3000 + i]){
+      printf(1, "sendfile data wrong\n");
+      exit();
+    }
+  }
+  unlink("sendsrc");
+  unlink("senddst");
+  unlink("sendout");
+  printf(1, "sendfile test ok\n");
+}
+
+// test that cached directory lookups, including
+// lookups of names that don't exist, follow link,
+// unlink, and a directory being replaced.
+void
+dcachetest(void)
+{
+  int fd;
+
+  printf(1, "dcache test\n");
+
+  if(open("dcd/x", 0) >= 0 || open("dcd/x", 0) >= 0){
+    printf(1, "open dcd/x succeeded before mkdir\n");
+    exit();
+  }
+  if(mkdir("dcd") != 0){
+    printf(1, "mkdir dcd failed\n");
+    exit();
+  }
+  if(open("dcd/x", 0) >= 0){
+    printf(1, "open dcd/x succeeded before create\n");
+    exit();
+  }
+  fd = open("dcd/x", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create dcd/x failed\n");
+    exit();
+  }
+  write(fd, "a", 1);
+  close(fd);
+  if(link("dcd/x", "dcd/y") != 0){
+    printf(1, "link dcd/x dcd/y failed\n");
+    exit();
+  }
+  if(unlink("dcd/x") != 0){
+    printf(1, "unlink dcd/x failed\n");
+    exit();
+  }
+  if(open("dcd/x", 0) >= 0){
+    printf(1, "open dcd/x succeeded after unlink\n");
+    exit();
+  }
+  if((fd = open("dcd/y", 0)) < 0){
+    printf(1, "open dcd/y failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dcd/y") != 0 || unlink("dcd") != 0){
+    printf(1, "unlink dcd failed\n");
+    exit();
+  }
+
+  // A new directory by the same name starts out empty.
+  if(mkdir("dcd") != 0){
+    printf(1, "second mkdir dcd failed\n");
+    exit();
+  }
+  if(open("dcd/y", 0) >= 0){
+    printf(1, "open dcd/y succeeded in new dcd\n");
+    exit();
+  }
+  if(unlink("dcd") != 0){
+    printf(1, "second unlink dcd failed\n");
+    exit();
+  }
+  printf(1, "dcache test ok\n");
+}
+
 void
 dirfile(void)
 {
@@ -1781,15 +2641,27 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipesize();
+  pipelend();
+  polltest();
+  nanosleeptest();
+  vdsotest();
+  sysentertf();
   preempt();
   exitwait();
 
   rmdot();
-  fourteen();
+  longname();
+  dirfull();
   bigfile();
   subdir();
   linktest();
   unlinkread();
+  dcachetest();
+  synctest();
+  mmaptest();
+  uiovtest();
+  sendfiletest();
   dirfile();
   iref();
   forktest();
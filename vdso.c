@@ -0,0 +1,75 @@
+//
+// The vdso pages (see vdso.h).  One shared page holds the
+// clock, which the clock interrupt updates under a sequence
+// count; each process has a page of its own with its pid.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "vdso.h"
+
+#if VDSOPROC != VDSO + PGSIZE || VDSOPROC + PGSIZE != KERNBASE
+#error "vdso pages must be the two below KERNBASE"
+#endif
+
+static struct vdsodata *vdata;
+
+void
+vdsoinit(void)
+{
+  if((vdata = (struct vdsodata*)kalloc()) == 0)
+    panic("vdsoinit");
+  memset(vdata, 0, PGSIZE);
+  vdata->hz = HZ;
+}
+
+// Publish the clock after a tick at cycle count tsc.
+// Called by the clock interrupt, with tickslock held.
+void
+vdsotick(uint tsc, uint tsctick)
+{
+  vdata->seq++;
+  __sync_synchronize();
+  vdata->ticks = ticks;
+  vdata->tsc = tsc;
+  vdata->tsctick = tsctick;
+  __sync_synchronize();
+  vdata->seq++;
+}
+
+// Map the vdso pages into pgdir, for process pid.
+// Returns -1 if out of memory.
+int
+vdsomap(pde_t *pgdir, int pid)
+{
+  struct vdsoproc *vp;
+  pte_t *pte;
+
+  if((vp = (struct vdsoproc*)kalloc()) == 0)
+    return -1;
+  memset(vp, 0, PGSIZE);
+  vp->pid = pid;
+  if((pte = walkpgdir(pgdir, (char*)VDSOPROC, 1)) == 0){
+    kfree((char*)vp);
+    return -1;
+  }
+  *pte = V2P(vp) | PTE_P | PTE_U;
+  // Same page table page, so this can't fail.
+  pte = walkpgdir(pgdir, (char*)VDSO, 1);
+  *pte = V2P(vdata) | PTE_P | PTE_U;
+  return 0;
+}
+
+// Take the shared page out of pgdir before freevm() frees
+// the user pages: it isn't the process's to free.
+void
+vdsounmap(pde_t *pgdir)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(pgdir, (char*)VDSO, 0)) != 0)
+    *pte = 0;
+}
@@ -0,0 +1,19 @@
+// Pages the kernel maps read-only into every process at VDSO,
+// so that ulib.c can answer getpid(), uptime() and nanouptime()
+// without a system call.  The first page is shared by all
+// processes; the second is the process's own.
+
+#define VDSO     0x7FFFE000     // KERNBASE - 2 pages; mmap() stays below
+#define VDSOPROC (VDSO + 0x1000)  // the process's page
+
+struct vdsodata {
+  uint seq;         // odd while the clock interrupt updates the rest
+  uint ticks;       // as uptime() returns
+  uint tsc;         // low 32 bits of the cycle counter at that tick
+  uint tsctick;     // cycles per tick; 0 until measured
+  uint hz;          // ticks per second
+};
+
+struct vdsoproc {
+  int pid;
+};
@@ -0,0 +1,233 @@
+// Virtio block device driver, a drop-in replacement for ide.c
+// for the file system disk (build with make DISK=virtio).
+//
+// Every request takes three chained descriptors: the request
+// header, the buf's data, and a status byte for the device
+// to fill in.  Any number of processes can have requests in
+// the queue at once; the device completes them in whatever
+// order it likes and interrupts once for a batch.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "virtio.h"
+
+#define PCI_BAR0   0x10
+#define PCI_INTR   0x3c  // interrupt line in the low byte
+
+// Bytes of memory needed for a queue of n descriptors.
+#define VQ_USEDOFF(n) PGROUNDUP(16*(n) + 6 + 2*(n))
+#define VQ_BYTES(n)   (VQ_USEDOFF(n) + PGROUNDUP(6 + 8*(n)))
+
+static char vqmem[VQ_BYTES(VIRTIO_MAXQ)] __attribute__((__aligned__(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;
+  int size;                     // number of descriptors
+  uint capacity;                // disk size in sectors
+  struct virtq_desc *desc;
+  struct virtq_avail *avail;
+  struct virtq_used *used;
+  ushort usedidx;               // used ring entries consumed so far
+
+  // Free descriptors, linked through desc[i].next.
+  int freehead;
+  int nfree;
+
+  // Per request, indexed by its first descriptor.
+  struct buf *bufs[VIRTIO_MAXQ];
+  struct virtio_blk_req hdrs[VIRTIO_MAXQ];
+  uchar status[VIRTIO_MAXQ];
+} vdisk;
+
+static int
+allocdesc(void)
+{
+  int i;
+
+  i = vdisk.freehead;
+  vdisk.freehead = vdisk.desc[i].next;
+  vdisk.nfree--;
+  return i;
+}
+
+static void
+freechain(int i)
+{
+  int next;
+
+  for(;;){
+    next = vdisk.desc[i].next;
+    vdisk.desc[i].next = vdisk.freehead;
+    vdisk.freehead = i;
+    vdisk.nfree++;
+    if(!(vdisk.desc[i].flags & VRING_DESC_F_NEXT))
+      break;
+    i = next;
+  }
+}
+
+void
+ideinit(void)
+{
+  uint tag;
+  int i;
+
+  initlock(&vdisk.lock, "virtio");
+  if(pcifinddev(VIRTIO_VENDOR, VIRTIO_DEV_BLK, &tag) < 0)
+    panic("ideinit: no virtio-blk device");
+  pcienable(tag);
+  vdisk.iobase = pciconfread(tag, PCI_BAR0) & 0xfffc;
+
+  // Reset, then tell the device we found it and can drive it.
+  // We need none of the optional features.
+  outb(vdisk.iobase + VIRTIO_STATUS, 0);
+  outb(vdisk.iobase + VIRTIO_STATUS, VIRTIO_STAT_ACK);
+  outb(vdisk.iobase + VIRTIO_STATUS, VIRTIO_STAT_ACK | VIRTIO_STAT_DRIVER);
+  outl(vdisk.iobase + VIRTIO_GUEST_FEATURES, 0);
+
+  // Lay out queue 0.
+  outw(vdisk.iobase + VIRTIO_QUEUE_SEL, 0);
+  vdisk.size = inw(vdisk.iobase + VIRTIO_QUEUE_SIZE);
+  if(vdisk.size == 0 || vdisk.size > VIRTIO_MAXQ)
+    panic("ideinit: virtio queue size");
+  memset(vqmem, 0, sizeof(vqmem));
+  vdisk.desc = (struct virtq_desc*)vqmem;
+  vdisk.avail = (struct virtq_avail*)(vqmem + 16*vdisk.size);
+  vdisk.used = (struct virtq_used*)(vqmem + VQ_USEDOFF(vdisk.size));
+  for(i = 0; i < vdisk.size; i++)
+    vdisk.desc[i].next = i + 1;
+  vdisk.freehead = 0;
+  vdisk.nfree = vdisk.size;
+  outl(vdisk.iobase + VIRTIO_QUEUE_PFN, V2P(vqmem) / PGSIZE);
+
+  vdisk.capacity = inl(vdisk.iobase + VIRTIO_BLK_CAPACITY);
+  if(inl(vdisk.iobase + VIRTIO_BLK_CAPACITY + 4) != 0)
+    vdisk.capacity = 0xffffffff;
+
+  outb(vdisk.iobase + VIRTIO_STATUS,
+       VIRTIO_STAT_ACK | VIRTIO_STAT_DRIVER | VIRTIO_STAT_DRIVER_OK);
+
+  diskirq = pciconfread(tag, PCI_INTR) & 0xff;
+  picenable(diskirq);
+  ioapicenable(diskirq, ncpu - 1);
+  cprintf("virtio: disk %d sectors, queue %d, irq %d\n",
+          vdisk.capacity, vdisk.size, diskirq);
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct virtq_used_elem *e;
+  struct buf *b;
+
+  acquire(&vdisk.lock);
+
+  // Reading the ISR acknowledges the interrupt.
+  inb(vdisk.iobase + VIRTIO_ISR);
+
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();
+    e = &vdisk.used->ring[vdisk.usedidx % vdisk.size];
+    b = vdisk.bufs[e->id];
+    if(vdisk.status[e->id] != 0)
+      cprintf("virtio: error on block %d\n", b->blockno);
+
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wqwakeup(&b->iowait);
+
+    vdisk.bufs[e->id] = 0;
+    freechain(e->id);
+    vdisk.usedidx++;
+  }
+  wakeup(&vdisk.nfree);
+
+  release(&vdisk.lock);
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  struct virtio_blk_req *hdr;
+  int d0, d1, d2;
+  uint sector;
+
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != 1)
+    panic("iderw: request not for disk 1");
+  sector = b->blockno * (BSIZE/512);
+  if(sector + BSIZE/512 > vdisk.capacity)
+    panic("iderw: block out of range");
+
+  acquire(&vdisk.lock);
+
+  while(vdisk.nfree < 3)
+    sleep(&vdisk.nfree, &vdisk.lock);
+  d0 = allocdesc();
+  d1 = allocdesc();
+  d2 = allocdesc();
+
+  hdr = &vdisk.hdrs[d0];
+  hdr->type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  hdr->reserved = 0;
+  hdr->sector = sector;
+  hdr->sectorhi = 0;
+  vdisk.status[d0] = 0xff;
+  vdisk.bufs[d0] = b;
+
+  vdisk.desc[d0].addr = V2P(hdr);
+  vdisk.desc[d0].addrhi = 0;
+  vdisk.desc[d0].len = sizeof(*hdr);
+  vdisk.desc[d0].flags = VRING_DESC_F_NEXT;
+  vdisk.desc[d0].next = d1;
+
+  vdisk.desc[d1].addr = V2P(b->data);
+  vdisk.desc[d1].addrhi = 0;
+  vdisk.desc[d1].len = BSIZE;
+  vdisk.desc[d1].flags = VRING_DESC_F_NEXT;
+  if(!(b->flags & B_DIRTY))
+    vdisk.desc[d1].flags |= VRING_DESC_F_WRITE;
+  vdisk.desc[d1].next = d2;
+
+  vdisk.desc[d2].addr = V2P(&vdisk.status[d0]);
+  vdisk.desc[d2].addrhi = 0;
+  vdisk.desc[d2].len = 1;
+  vdisk.desc[d2].flags = VRING_DESC_F_WRITE;
+  vdisk.desc[d2].next = 0;
+
+  // Publish the chain, then the new index, and only then
+  // (unless the device said it is still busy with the
+  // queue) take the VM exit of a notify.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.size] = d0;
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  if(!(vdisk.used->flags & VRING_USED_F_NO_NOTIFY))
+    outw(vdisk.iobase + VIRTIO_QUEUE_NOTIFY, 0);
+
+  // Wait for request to finish.
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    wqsleep(&b->iowait, &vdisk.lock);
+
+  release(&vdisk.lock);
+}
@@ -0,0 +1,69 @@
+// Virtio over PCI, legacy (virtio 0.9.5) interface, as
+// offered by QEMU's transitional virtio-blk-pci device.
+// See the Virtio PCI Card Specification v0.9.5.
+
+#define VIRTIO_VENDOR     0x1af4
+#define VIRTIO_DEV_BLK    0x1001  // transitional block device
+
+// Registers in the I/O space of BAR0.
+#define VIRTIO_HOST_FEATURES  0x00  // 32 bits, device features
+#define VIRTIO_GUEST_FEATURES 0x04  // 32 bits, features we accept
+#define VIRTIO_QUEUE_PFN      0x08  // 32 bits, queue address / PGSIZE
+#define VIRTIO_QUEUE_SIZE     0x0c  // 16 bits, read-only
+#define VIRTIO_QUEUE_SEL      0x0e  // 16 bits
+#define VIRTIO_QUEUE_NOTIFY   0x10  // 16 bits
+#define VIRTIO_STATUS         0x12  // 8 bits
+#define VIRTIO_ISR            0x13  // 8 bits, cleared by reading
+#define VIRTIO_CONFIG         0x14  // device-specific configuration
+
+// Device status bits.
+#define VIRTIO_STAT_ACK       1
+#define VIRTIO_STAT_DRIVER    2
+#define VIRTIO_STAT_DRIVER_OK 4
+#define VIRTIO_STAT_FAILED    128
+
+// virtio-blk configuration: capacity in 512-byte sectors.
+#define VIRTIO_BLK_CAPACITY   (VIRTIO_CONFIG + 0)
+
+// A virtqueue is three rings in physically contiguous memory:
+// descriptors, then the available ring, then (at the next
+// page boundary) the used ring.
+#define VIRTIO_MAXQ  256   // largest queue the driver can lay out
+
+struct virtq_desc {
+  uint addr;      // physical address, low 32 bits
+  uint addrhi;    // high 32 bits, always 0 here
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VRING_DESC_F_NEXT   1  // chained with another descriptor
+#define VRING_DESC_F_WRITE  2  // device writes (vs reads)
+
+struct virtq_avail {
+  ushort flags;
+  ushort idx;         // where we put the next entry, mod queue size
+  ushort ring[];      // heads of descriptor chains
+};
+
+struct virtq_used_elem {
+  uint id;            // head of the completed descriptor chain
+  uint len;
+};
+
+struct virtq_used {
+  ushort flags;
+  ushort idx;         // where the device puts the next entry
+  struct virtq_used_elem ring[];
+};
+#define VRING_USED_F_NO_NOTIFY  1  // device doesn't want notifies
+
+// The header that starts every virtio-blk request.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;        // in 512-byte units, low 32 bits
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN   0  // read the disk
+#define VIRTIO_BLK_T_OUT  1  // write the disk
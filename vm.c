@@ -8,7 +8,9 @@
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
+extern void sysentry(void);  // in trapasm.S
 pde_t *kpgdir;  // for use in scheduler()
+int sysenterok;  // CPUs support sysenter
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -16,6 +18,7 @@ void
 seginit(void)
 {
   struct cpu *c;
+  uint edx;
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
@@ -33,6 +36,18 @@ seginit(void)
   lgdt(c->gdt, sizeof(c->gdt));
   loadgs(SEG_KCPU << 3);
 
+  // Fast system calls.  sysenter jumps to sysentry with %esp
+  // at the top of sysstack, whose top word switchuvm() keeps equal
+  // to ts.esp0.  sysstack is a real stack, not just that word,
+  // since a debug trap on sysentry's first instruction lands there.
+  cpuid(1, 0, 0, 0, &edx);
+  if(edx & CPUID_SEP){
+    sysenterok = 1;
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3, 0);
+    wrmsr(MSR_SYSENTER_ESP, (uint)&c->sysstack[NELEM(c->sysstack)-1], 0);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysentry, 0);
+  }
+
   // Initialize cpu-local storage.
   cpu = c;
   proc = 0;
@@ -41,7 +56,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
   pde_t *pde;
@@ -168,6 +183,7 @@ switchuvm(struct proc *p)
   cpu->gdt[SEG_TSS].s = 0;
   cpu->ts.ss0 = SEG_KDATA << 3;
   cpu->ts.esp0 = (uint)proc->kstack + KSTACKSIZE;
+  cpu->sysstack[NELEM(cpu->sysstack)-1] = cpu->ts.esp0;
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   cpu->ts.iomb = (ushort) 0xFFFF;
@@ -288,6 +304,7 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  vdsounmap(pgdir);
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
     if(pgdir[i] & PTE_P){
@@ -351,7 +368,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;